@@ -0,0 +1,34 @@
+/*
+    This software is Copyright by the Board of Trustees of Michigan
+    State University (c) Copyright 2025.
+
+    You may use this software under the terms of the GNU public license
+    (GPL).  The terms of this license are described at:
+
+     http://www.gnu.org/licenses/gpl.txt
+
+     Authors:
+             Genie Jhang
+	     FRIB
+	     Michigan State University
+	     East Lansing, MI 48824-1321
+*/
+
+#ifndef CNULLDATASINK_H
+#define CNULLDATASINK_H
+
+#include <CDataSink.h>
+
+// Data sink that discards everything put into it.
+// Used by the parameter scan when only the summary of a configuration is wanted.
+class CNullDataSink : public CDataSink {
+	public:
+		CNullDataSink() {};
+		virtual ~CNullDataSink() {};
+
+	public:
+		virtual void putItem(const CRingItem &item) {};
+		virtual void put(const void *pData, size_t nBytes) {};
+};
+
+#endif
@@ -0,0 +1,137 @@
+/*
+    This software is Copyright by the Board of Trustees of Michigan
+    State University (c) Copyright 2025.
+
+    You may use this software under the terms of the GNU public license
+    (GPL).  The terms of this license are described at:
+
+     http://www.gnu.org/licenses/gpl.txt
+
+     Authors:
+             Genie Jhang
+	     FRIB
+	     Michigan State University
+	     East Lansing, MI 48824-1321
+*/
+
+#ifndef CTHREADEDDATASOURCE_H
+#define CTHREADEDDATASOURCE_H
+
+#include <CDataSource.h>
+#include <CRingItem.h>
+#include <Exception.h>
+
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <deque>
+
+// Reads a CDataSource on its own thread so that the consumer can wait for items with a timeout.
+// CDataSource::getItem() blocks forever on an idle online ring, which leaves no chance to
+// act on the passage of time. At most maxQueued items are read ahead.
+class CThreadedDataSource {
+	public:
+		CThreadedDataSource(CDataSource *pSource, size_t maxQueued = 4096)
+		: pSource(pSource), maxQueued(maxQueued), reader(&CThreadedDataSource::readLoop, this) {};
+		~CThreadedDataSource() {
+			bool readerDone;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopRequested = true;
+				readerDone = exhausted;
+			}
+			notFull.notify_all();
+
+			// The reader may be blocked inside the source for good when the ring is idle.
+			// Only the end of the program destroys a reader that is still running.
+			if (readerDone) {
+				reader.join();
+			} else {
+				reader.detach();
+			}
+
+			for (auto pItem : items) {
+				delete pItem;
+			}
+		};
+
+	public:
+		/**
+		 * getItem
+		 *    Waits up to timeout for the next item.
+		 *
+		 * @param pItem   - set to the item, or nullptr once the source is exhausted.
+		 * @param timeout - longest time to wait.
+		 *
+		 * @return false if nothing arrived within timeout. pItem is untouched then.
+		 */
+		bool getItem(CRingItem *&pItem, std::chrono::milliseconds timeout) {
+			std::unique_lock<std::mutex> lock(mutex);
+			if (!notEmpty.wait_for(lock, timeout, [this] { return !items.empty() || exhausted; })) {
+				return false;
+			}
+
+			if (items.empty()) {
+				pItem = nullptr;
+
+				return true;
+			}
+
+			pItem = items.front();
+			items.pop_front();
+			lock.unlock();
+			notFull.notify_one();
+
+			return true;
+		};
+
+	private:
+		void readLoop() {
+			while (true) {
+				CRingItem *pItem = nullptr;
+				try {
+					pItem = pSource -> getItem();
+				} catch (CException &e) {
+					std::cerr << "Failed to read from the ring source: " << e.ReasonText() << std::endl;
+				}
+
+				std::unique_lock<std::mutex> lock(mutex);
+				if (pItem == nullptr) {
+					exhausted = true;
+					lock.unlock();
+					notEmpty.notify_all();
+
+					return;
+				}
+
+				notFull.wait(lock, [this] { return items.size() < maxQueued || stopRequested; });
+				if (stopRequested) {
+					delete pItem;
+					exhausted = true;
+
+					return;
+				}
+
+				items.push_back(pItem);
+				lock.unlock();
+				notEmpty.notify_one();
+			}
+		};
+
+	private:
+		CDataSource *pSource;
+		size_t maxQueued;
+
+		std::mutex mutex;
+		std::condition_variable notEmpty;
+		std::condition_variable notFull;
+		std::deque<CRingItem *> items;
+		bool exhausted = false;
+		bool stopRequested = false;
+
+		std::thread reader;
+};
+
+#endif
@@ -0,0 +1,243 @@
+/*
+    This software is Copyright by the Board of Trustees of Michigan
+    State University (c) Copyright 2025.
+
+    You may use this software under the terms of the GNU public license
+    (GPL).  The terms of this license are described at:
+
+     http://www.gnu.org/licenses/gpl.txt
+
+     Authors:
+             Genie Jhang
+	     FRIB
+	     Michigan State University
+	     East Lansing, MI 48824-1321
+*/
+
+#ifndef MDPPSCPSROCALIBRATOR_H
+#define MDPPSCPSROCALIBRATOR_H
+
+#include <vector>
+#include <deque>
+#include <utility>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "MDPPSCPSRO.h"
+
+// Finds the trigger window from the data.
+// Every pair of a hit and a trigger channel hit within range of each other fills the histogram of
+// the hit channel with (hit time - trigger time). The histograms have a fixed number of bins and
+// only the hits and triggers of the last range are kept to pair with, so the cost doesn't grow
+// with the length of the run. Coincidences show up as a peak on the flat background of accidentals.
+class MDPPSCPSROCalibrator {
+	public:
+		/**
+		 * @param triggerChannel - channel whose hits are the triggers.
+		 * @param numChannels    - channels histogrammed. Hits of other channels are ignored.
+		 * @param range          - largest |hit time - trigger time| in MDPP_TDC_UNIT.
+		 * @param binWidth       - histogram bin width in MDPP_TDC_UNIT.
+		 */
+		MDPPSCPSROCalibrator(int triggerChannel, int numChannels, uint64_t range, uint64_t binWidth)
+		: triggerChannel(triggerChannel), range(range), binWidth(std::max<uint64_t>(binWidth, 1)) {
+			numBins = 2*((range + this -> binWidth - 1)/this -> binWidth);
+			histograms.assign(numChannels, std::vector<uint64_t>(numBins, 0));
+			peaks.assign(numChannels, Peak());
+		};
+		~MDPPSCPSROCalibrator() {};
+
+	public:
+		/**
+		 * fill
+		 *    Pairs a hit with the triggers of the last range, or a trigger with the hits of the last range.
+		 *
+		 * @param hit       - the hit.
+		 * @param timestamp - absolute MDPP timestamp of the hit.
+		 */
+		void fill(const MDPPSCPSRO &hit, uint64_t timestamp) {
+			while (!recentHits.empty() && recentHits.front().first + range < timestamp) {
+				recentHits.pop_front();
+			}
+
+			while (!recentTriggers.empty() && recentTriggers.front() + range < timestamp) {
+				recentTriggers.pop_front();
+			}
+
+			if (hit.ch == triggerChannel) {
+				for (auto &recentHit : recentHits) {
+					add(recentHit.second, static_cast<int64_t>(recentHit.first) - static_cast<int64_t>(timestamp));
+				}
+
+				recentTriggers.push_back(timestamp);
+				numTriggers++;
+			} else if (hit.ch >= 0 && hit.ch < static_cast<int>(histograms.size())) {
+				for (auto recentTrigger : recentTriggers) {
+					add(hit.ch, static_cast<int64_t>(timestamp) - static_cast<int64_t>(recentTrigger));
+				}
+
+				recentHits.push_back(std::make_pair(timestamp, hit.ch));
+			}
+		};
+
+		uint64_t getNumTriggers() const { return numTriggers; };
+		int getNumChannels() const { return histograms.size(); };
+
+		/**
+		 * findPeak
+		 *    Finds the coincidence peak of a channel on the histogram smoothed over SMOOTHING bins:
+		 *    the bins around the highest one that stay above the background by more than PEAK_FRACTION
+		 *    of the peak height. The background is the mean bin outside the peak.
+		 *    The peak must hold at least PEAK_SIGNIFICANCE^2 counts above the background and
+		 *    PEAK_SIGNIFICANCE times the square root of the background under it.
+		 *    The result is kept until the histogram of the channel is filled again.
+		 *
+		 * @param ch        - the channel.
+		 * @param low       - set to the lower edge of the peak in (hit time - trigger time), MDPP_TDC_UNIT.
+		 * @param high      - set to the upper edge of the peak.
+		 *
+		 * @return false if there's no significant peak.
+		 */
+		bool findPeak(int ch, int64_t &low, int64_t &high) const {
+			Peak &peak = peaks[ch];
+			if (!peak.isValid) {
+				peak.isFound = locatePeak(ch, peak.low, peak.high);
+				peak.isValid = true;
+			}
+
+			low  = peak.low;
+			high = peak.high;
+
+			return peak.isFound;
+		};
+
+		/**
+		 * suggestWindow
+		 *    Suggests the trigger window covering the peaks of all channels.
+		 *    The window is (t_ch - windowStart, t_ch - windowStart + windowWidth).
+		 *
+		 * @return false if no channel has a peak.
+		 */
+		bool suggestWindow(uint64_t &windowStart, uint64_t &windowWidth) const {
+			bool isFound = false;
+			int64_t low = 0, high = 0;
+			for (int ch = 0; ch < getNumChannels(); ch++) {
+				int64_t peakLow, peakHigh;
+				if (ch == triggerChannel || !findPeak(ch, peakLow, peakHigh)) {
+					continue;
+				}
+
+				low  = isFound ? std::min(low, peakLow) : peakLow;
+				high = isFound ? std::max(high, peakHigh) : peakHigh;
+				isFound = true;
+			}
+
+			if (!isFound) {
+				return false;
+			}
+
+			// The window always includes the trigger hit itself.
+			low  = std::min<int64_t>(low, 0);
+			high = std::max<int64_t>(high, 0);
+
+			windowStart = -low;
+			windowWidth = high - low;
+
+			return true;
+		};
+
+	private:
+		void add(int ch, int64_t difference) {
+			int64_t bin = (difference + static_cast<int64_t>(numBins/2*binWidth))/static_cast<int64_t>(binWidth);
+			if (difference < -static_cast<int64_t>(numBins/2*binWidth) || bin >= static_cast<int64_t>(numBins)) {
+				return;
+			}
+
+			histograms[ch][bin]++;
+			peaks[ch].isValid = false;
+		};
+
+		bool locatePeak(int ch, int64_t &low, int64_t &high) const {
+			const std::vector<uint64_t> &histogram = histograms[ch];
+
+			double total = 0;
+			for (size_t bin = 0; bin < numBins; bin++) {
+				total += histogram[bin];
+			}
+			double background = total/numBins;
+
+			std::vector<double> smoothed(numBins, 0);
+			for (size_t bin = 0; bin < numBins; bin++) {
+				size_t first = bin < SMOOTHING/2 ? 0 : bin - SMOOTHING/2;
+				size_t last  = std::min(bin + SMOOTHING/2, numBins - 1);
+				for (size_t i = first; i <= last; i++) {
+					smoothed[bin] += histogram[i];
+				}
+				smoothed[bin] /= last - first + 1;
+			}
+
+			size_t peakBin = std::max_element(smoothed.begin(), smoothed.end()) - smoothed.begin();
+			double height = smoothed[peakBin] - background;
+			if (height <= 0) {
+				return false;
+			}
+
+			double threshold = background + PEAK_FRACTION*height;
+			size_t first = peakBin, last = peakBin;
+			while (first > 0 && smoothed[first - 1] > threshold) {
+				first--;
+			}
+			while (last + 1 < numBins && smoothed[last + 1] > threshold) {
+				last++;
+			}
+
+			double inPeak = 0;
+			for (size_t bin = first; bin <= last; bin++) {
+				inPeak += histogram[bin];
+			}
+
+			size_t width = last - first + 1;
+			if (width < numBins) {
+				background = (total - inPeak)/(numBins - width);
+			}
+
+			double excess = inPeak - background*width;
+			if (excess < PEAK_SIGNIFICANCE*PEAK_SIGNIFICANCE || excess < PEAK_SIGNIFICANCE*std::sqrt(background*width)) {
+				return false;
+			}
+
+			low  = binLowEdge(first);
+			high = binLowEdge(last + 1);
+
+			return true;
+		};
+
+		int64_t binLowEdge(size_t bin) const {
+			return static_cast<int64_t>(bin*binWidth) - static_cast<int64_t>(numBins/2*binWidth);
+		};
+
+	private:
+		static const size_t SMOOTHING = 5;
+		static constexpr double PEAK_FRACTION     = 0.1;
+		static constexpr double PEAK_SIGNIFICANCE = 5;
+
+		struct Peak {
+			bool isValid = false;
+			bool isFound = false;
+			int64_t low  = 0;
+			int64_t high = 0;
+		};
+
+		int triggerChannel;
+		uint64_t range;
+		uint64_t binWidth;
+		size_t numBins;
+
+		std::vector<std::vector<uint64_t>> histograms;
+		std::deque<std::pair<uint64_t, int>> recentHits;
+		std::deque<uint64_t> recentTriggers;
+		uint64_t numTriggers = 0;
+		mutable std::vector<Peak> peaks; // findPeak results
+};
+
+#endif
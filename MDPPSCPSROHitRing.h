@@ -0,0 +1,160 @@
+/*
+    This software is Copyright by the Board of Trustees of Michigan
+    State University (c) Copyright 2025.
+
+    You may use this software under the terms of the GNU public license
+    (GPL).  The terms of this license are described at:
+
+     http://www.gnu.org/licenses/gpl.txt
+
+     Authors:
+             Genie Jhang
+	     FRIB
+	     Michigan State University
+	     East Lansing, MI 48824-1321
+*/
+
+#ifndef MDPPSCPSROHITRING_H
+#define MDPPSCPSROHITRING_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+#include "MDPPSCPSRO.h"
+
+// Ring buffer of hits kept in time order.
+// Hits are stored by value and their absolute timestamps are kept in a separate array,
+// so a trigger window is located by binary search over the timestamps only and
+// the hits before and inside it are taken out from the front in one go.
+// Indices are logical: 0 is the oldest hit.
+class MDPPSCPSROHitRing {
+	public:
+		MDPPSCPSROHitRing(size_t capacity = 1024) {
+			size_t powerOfTwo = 1;
+			while (powerOfTwo < capacity) {
+				powerOfTwo <<= 1;
+			}
+
+			hits.resize(powerOfTwo);
+			timestamps.resize(powerOfTwo);
+			mask = powerOfTwo - 1;
+		};
+		~MDPPSCPSROHitRing() {};
+
+	public:
+		bool empty() const { return count == 0; };
+		size_t size() const { return count; };
+
+		MDPPSCPSRO &operator[](size_t index) { return hits[(head + index) & mask]; };
+		uint64_t timestamp(size_t index) const { return timestamps[(head + index) & mask]; };
+
+		MDPPSCPSRO &front() { return (*this)[0]; };
+		MDPPSCPSRO &back() { return (*this)[count - 1]; };
+
+		/**
+		 * push
+		 *    Adds a hit keeping the time order. A hit older than the newest one,
+		 *    which happens for reversed order events, is moved back to its place.
+		 *
+		 * @param hit       - the hit.
+		 * @param timestamp - absolute MDPP timestamp of the hit.
+		 */
+		void push(const MDPPSCPSRO &hit, uint64_t timestamp) {
+			if (count == hits.size()) {
+				grow();
+			}
+
+			size_t index = count;
+			while (index > 0 && this -> timestamp(index - 1) > timestamp) {
+				(*this)[index] = (*this)[index - 1];
+				timestamps[(head + index) & mask] = this -> timestamp(index - 1);
+				index--;
+			}
+
+			(*this)[index] = hit;
+			timestamps[(head + index) & mask] = timestamp;
+			count++;
+		};
+
+		void popFront(size_t n = 1) {
+			head   = (head + n) & mask;
+			count -= n;
+		};
+
+		void popBack() {
+			count--;
+		};
+
+		void erase(size_t index) {
+			for (size_t i = index; i + 1 < count; i++) {
+				(*this)[i] = (*this)[i + 1];
+				timestamps[(head + i) & mask] = this -> timestamp(i + 1);
+			}
+			count--;
+		};
+
+		// Number of hits older than timestamp.
+		size_t lowerBound(uint64_t timestamp) const {
+			size_t first = 0, length = count;
+			while (length > 0) {
+				size_t half = length/2;
+				if (this -> timestamp(first + half) < timestamp) {
+					first  += half + 1;
+					length -= half + 1;
+				} else {
+					length  = half;
+				}
+			}
+
+			return first;
+		};
+
+		// Number of hits not newer than timestamp.
+		size_t upperBound(uint64_t timestamp) const {
+			size_t first = 0, length = count;
+			while (length > 0) {
+				size_t half = length/2;
+				if (this -> timestamp(first + half) <= timestamp) {
+					first  += half + 1;
+					length -= half + 1;
+				} else {
+					length  = half;
+				}
+			}
+
+			return first;
+		};
+
+		// Appends the n oldest hits to out as at most two contiguous copies.
+		void copyFront(size_t n, std::vector<MDPPSCPSRO> &out) const {
+			size_t firstPart = std::min(n, hits.size() - head);
+			out.insert(out.end(), hits.begin() + head, hits.begin() + head + firstPart);
+			out.insert(out.end(), hits.begin(), hits.begin() + (n - firstPart));
+		};
+
+	private:
+		void grow() {
+			std::vector<MDPPSCPSRO> newHits(hits.size()*2);
+			std::vector<uint64_t> newTimestamps(timestamps.size()*2);
+			for (size_t i = 0; i < count; i++) {
+				newHits[i]       = (*this)[i];
+				newTimestamps[i] = timestamp(i);
+			}
+
+			hits.swap(newHits);
+			timestamps.swap(newTimestamps);
+			head = 0;
+			mask = hits.size() - 1;
+		};
+
+	private:
+		std::vector<MDPPSCPSRO> hits;
+		std::vector<uint64_t> timestamps;
+		size_t head  = 0;
+		size_t count = 0;
+		size_t mask  = 0;
+};
+
+#endif
@@ -0,0 +1,268 @@
+/*
+    This software is Copyright by the Board of Trustees of Michigan
+    State University (c) Copyright 2025.
+
+    You may use this software under the terms of the GNU public license
+    (GPL).  The terms of this license are described at:
+
+     http://www.gnu.org/licenses/gpl.txt
+
+     Authors:
+             Genie Jhang
+	     FRIB
+	     Michigan State University
+	     East Lansing, MI 48824-1321
+*/
+
+#ifndef MDPPSCPSROINDEX_H
+#define MDPPSCPSROINDEX_H
+
+#include <CDataSink.h>
+#include <CRingItem.h>
+#include <DataFormat.h>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Sidecar time index of an output .evt file, written next to it as <file>.idx.
+// The file is MDPPSCPSRO_INDEX_MAGIC followed by entries. An entry says that the item at
+// offset, preceded by itemCount items, is the first one written at timestamp or later.
+// Timestamps are absolute MDPP timestamps in MDPP_TDC_UNIT and never decrease along the file.
+
+static const char MDPPSCPSRO_INDEX_MAGIC[8] = {'M', 'D', 'P', 'P', 'I', 'D', 'X', '1'};
+
+struct MDPPSCPSROIndexEntry {
+	uint64_t timestamp;
+	uint64_t offset;
+	uint64_t itemCount;
+};
+
+// Data sink writing through another one while keeping the index of what it wrote.
+// An entry is added whenever the body header timestamp of a physics event moved interval past the
+// last entry, and wherever mark() is called. State and scaler items may carry NULL_TIMESTAMP and are
+// never indexed.
+class CIndexedDataSink : public CDataSink {
+	public:
+		CIndexedDataSink(CDataSink *pSink, const std::string &indexPath, uint64_t interval)
+		: pSink(pSink), interval(interval) {
+			fd = open(indexPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			if (fd >= 0 && write(fd, MDPPSCPSRO_INDEX_MAGIC, sizeof(MDPPSCPSRO_INDEX_MAGIC)) < 0) {
+				close(fd);
+				fd = -1;
+			}
+		};
+		virtual ~CIndexedDataSink() {
+			if (fd >= 0) {
+				close(fd);
+			}
+		};
+
+	public:
+		bool isOpen() const { return fd >= 0; };
+
+		virtual void putItem(const CRingItem &item) {
+			if (item.type() == PHYSICS_EVENT && item.hasBodyHeader()) {
+				uint64_t timestamp = item.getEventTimestamp();
+				if (!isIndexed || (timestamp >= lastTimestamp && timestamp - lastTimestamp >= interval)) {
+					mark(timestamp);
+				}
+			}
+
+			pSink -> putItem(item);
+
+			if (item.type() == PHYSICS_EVENT && item.hasBodyHeader() && item.getEventTimestamp() != NULL_TIMESTAMP) {
+				maxTimestamp = isWritten ? std::max(maxTimestamp, item.getEventTimestamp()) : item.getEventTimestamp();
+				isWritten    = true;
+			}
+
+			offset += item.size();
+			itemCount++;
+		};
+
+		virtual void put(const void *pData, size_t nBytes) {
+			pSink -> put(pData, nBytes);
+
+			offset += nBytes;
+		};
+
+		// Adds an entry for the next item written, which is at timestamp.
+		void mark(uint64_t timestamp) {
+			if (fd < 0 || timestamp == NULL_TIMESTAMP) {
+				return;
+			}
+
+			// Entries are kept in order for the binary search even if items are not quite, and
+			// are later than every item before them so that seeking never skips one.
+			timestamp = std::max(timestamp, lastTimestamp);
+			if (isWritten) {
+				timestamp = std::max(timestamp, maxTimestamp + 1);
+			}
+			if (isIndexed && offset == lastOffset) {
+				return;
+			}
+
+			MDPPSCPSROIndexEntry entry = {timestamp, offset, itemCount};
+			if (write(fd, &entry, sizeof(entry)) < 0) {
+				close(fd);
+				fd = -1;
+			}
+
+			lastTimestamp = timestamp;
+			lastOffset    = offset;
+			isIndexed     = true;
+		};
+
+	private:
+		std::unique_ptr<CDataSink> pSink;
+		uint64_t interval;
+		int fd = -1;
+
+		uint64_t offset    = 0;
+		uint64_t itemCount = 0;
+
+		bool     isIndexed     = false;
+		uint64_t lastTimestamp = 0;
+		uint64_t lastOffset    = 0;
+
+		bool     isWritten     = false; // physics event with a timestamp written
+		uint64_t maxTimestamp  = 0;     // latest of them
+};
+
+// Reads an output .evt file through its sidecar index.
+// The .evt file is mapped into memory so that seek() hands out a pointer to the ring item right away.
+//
+//    MDPPSCPSROIndexReader reader;
+//    if (reader.open("run-0001-softtrig.evt")) {
+//      const uint8_t *p = reader.seek(timestamp);
+//      while (p < reader.end()) {
+//        // p points to a ring item: uint32_t size, uint32_t type, ...
+//        p += *reinterpret_cast<const uint32_t *>(p);
+//      }
+//    }
+class MDPPSCPSROIndexReader {
+	public:
+		MDPPSCPSROIndexReader() {};
+		~MDPPSCPSROIndexReader() {
+			close();
+		};
+
+	public:
+		/**
+		 * open
+		 *    Maps evtPath and reads its index from evtPath.idx.
+		 *
+		 * @return false if either file can't be read or the index is not an index.
+		 */
+		bool open(const std::string &evtPath) {
+			close();
+
+			int indexFd = ::open((evtPath + ".idx").c_str(), O_RDONLY);
+			if (indexFd < 0) {
+				return false;
+			}
+
+			struct stat indexStat;
+			char magic[sizeof(MDPPSCPSRO_INDEX_MAGIC)];
+			if (fstat(indexFd, &indexStat) < 0
+			    || read(indexFd, magic, sizeof(magic)) != sizeof(magic)
+			    || std::memcmp(magic, MDPPSCPSRO_INDEX_MAGIC, sizeof(magic)) != 0) {
+				::close(indexFd);
+
+				return false;
+			}
+
+			entries.resize((indexStat.st_size - sizeof(magic))/sizeof(MDPPSCPSROIndexEntry));
+			ssize_t entryBytes = entries.size()*sizeof(MDPPSCPSROIndexEntry);
+			bool isRead = read(indexFd, entries.data(), entryBytes) == entryBytes;
+			::close(indexFd);
+
+			if (!isRead) {
+				entries.clear();
+
+				return false;
+			}
+
+			int evtFd = ::open(evtPath.c_str(), O_RDONLY);
+			if (evtFd < 0) {
+				entries.clear();
+
+				return false;
+			}
+
+			struct stat evtStat;
+			if (fstat(evtFd, &evtStat) == 0 && evtStat.st_size > 0) {
+				mapSize = evtStat.st_size;
+				void *pMap = mmap(nullptr, mapSize, PROT_READ, MAP_PRIVATE, evtFd, 0);
+				pData = pMap == MAP_FAILED ? nullptr : static_cast<const uint8_t *>(pMap);
+			}
+			::close(evtFd);
+
+			if (pData == nullptr) {
+				entries.clear();
+				mapSize = 0;
+
+				return false;
+			}
+
+			return true;
+		};
+
+		void close() {
+			if (pData != nullptr) {
+				munmap(const_cast<uint8_t *>(pData), mapSize);
+			}
+
+			pData   = nullptr;
+			mapSize = 0;
+			entries.clear();
+		};
+
+		const std::vector<MDPPSCPSROIndexEntry> &getEntries() const { return entries; };
+
+		/**
+		 * find
+		 *    Finds the last entry at or before timestamp. Reading on from there reaches every
+		 *    item at timestamp or later.
+		 *
+		 * @return the entry, or nullptr if there's no index.
+		 */
+		const MDPPSCPSROIndexEntry *find(uint64_t timestamp) const {
+			if (entries.empty()) {
+				return nullptr;
+			}
+
+			auto next = std::upper_bound(entries.begin(), entries.end(), timestamp,
+			                             [](uint64_t t, const MDPPSCPSROIndexEntry &entry) { return t < entry.timestamp; });
+
+			return next == entries.begin() ? &entries.front() : &*(next - 1);
+		};
+
+		// Pointer to the ring item of find(timestamp), or end() if there's none.
+		const uint8_t *seek(uint64_t timestamp) const {
+			const MDPPSCPSROIndexEntry *pEntry = find(timestamp);
+			if (pEntry == nullptr || pEntry -> offset >= mapSize) {
+				return end();
+			}
+
+			return pData + pEntry -> offset;
+		};
+
+		const uint8_t *begin() const { return pData; };
+		const uint8_t *end() const { return pData + mapSize; };
+
+	private:
+		std::vector<MDPPSCPSROIndexEntry> entries;
+		const uint8_t *pData = nullptr;
+		size_t mapSize = 0;
+};
+
+#endif
@@ -0,0 +1,311 @@
+/*
+    This software is Copyright by the Board of Trustees of Michigan
+    State University (c) Copyright 2025.
+
+    You may use this software under the terms of the GNU public license
+    (GPL).  The terms of this license are described at:
+
+     http://www.gnu.org/licenses/gpl.txt
+
+     Authors:
+             Genie Jhang
+	     FRIB
+	     Michigan State University
+	     East Lansing, MI 48824-1321
+*/
+
+#ifndef MDPPSCPSROMERGER_H
+#define MDPPSCPSROMERGER_H
+
+#include <CDataSource.h>
+#include <CRingItem.h>
+#include <DataFormat.h>
+
+#include <vector>
+#include <queue>
+#include <memory>
+#include <chrono>
+#include <functional>
+#include <utility>
+#include <algorithm>
+#include <thread>
+#include <cstdint>
+
+#include "MDPPSCPSRO.h"
+#include "CThreadedDataSource.h"
+
+// Merges the hits of several sources into one time-ordered stream.
+// Every source is read on its own thread and keeps its own rollover counter, and its clock offset
+// is added to its absolute timestamps. The oldest head hit of all sources is taken from a heap once
+// every source has a head hit, finished, or stalled. A source stalls when no hit came from it for
+// maxLag; the merge goes on without it and its hits are merged again once they arrive.
+// Only the non-physics items of the first source are passed on, and the end of run item when
+// every source has ended the run.
+class MDPPSCPSROMerger {
+	public:
+		enum Next { NOTHING, HIT, ITEM, END };
+
+		MDPPSCPSROMerger(std::function<void(CRingItem &, MDPPSCPSRO &)> unpack, std::chrono::milliseconds maxLag)
+		: unpack(unpack), maxLag(maxLag) {};
+		~MDPPSCPSROMerger() {};
+
+	public:
+		/**
+		 * addSource
+		 *    Adds a source to merge. The first source added passes its non-physics items on.
+		 *
+		 * @param pSource     - the source.
+		 * @param clockOffset - added to the absolute timestamps of the source in MDPP_TDC_UNIT.
+		 */
+		void addSource(CDataSource *pSource, int64_t clockOffset) {
+			std::unique_ptr<Source> source(new Source());
+			source -> reader.reset(new CThreadedDataSource(pSource));
+			source -> clockOffset = clockOffset;
+			source -> lastArrival = std::chrono::steady_clock::now();
+
+			sources.push_back(std::move(source));
+		};
+
+		/**
+		 * getNext
+		 *    Waits up to timeout for the next hit or item.
+		 *
+		 * @param hit     - the hit, for HIT. Its timestamp and rollover counter are merged ones.
+		 * @param pItem   - the item, for ITEM. The caller owns it.
+		 * @param timeout - longest time to wait.
+		 *
+		 * @return NOTHING if nothing is ready within timeout, END when all sources are exhausted.
+		 */
+		Next getNext(MDPPSCPSRO &hit, CRingItem *&pItem, std::chrono::milliseconds timeout) {
+			std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+
+			while (true) {
+				for (size_t i = 0; i < sources.size(); i++) {
+					while (!sources[i] -> hasHead && !isHeld(*sources[i]) && !sources[i] -> isExhausted) {
+						CRingItem *pSourceItem = nullptr;
+						if (!sources[i] -> reader -> getItem(pSourceItem, std::chrono::milliseconds(0))) {
+							break;
+						}
+
+						if (read(i, pSourceItem)) {
+							pItem = pendingItem;
+							pendingItem = nullptr;
+
+							return ITEM;
+						}
+					}
+				}
+
+				Source *pWaitFor = nullptr;
+				std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+				for (auto &source : sources) {
+					if (!source -> hasHead && !isHeld(*source) && !source -> isExhausted && now - source -> lastArrival < maxLag) {
+						pWaitFor = source.get();
+
+						break;
+					}
+				}
+
+				if (pWaitFor == nullptr) {
+					if (!heads.empty()) {
+						size_t index = heads.top().second;
+						heads.pop();
+
+						hit = sources[index] -> head;
+						sources[index] -> hasHead = false;
+
+						return HIT;
+					}
+
+					if (allEnded()) {
+						numRunsEnded++;
+
+						if (endRunItem != nullptr) {
+							pItem = endRunItem;
+							endRunItem = nullptr;
+
+							return ITEM;
+						}
+					}
+
+					if (allExhausted()) {
+						return END;
+					}
+				}
+
+				if (now >= deadline) {
+					return NOTHING;
+				}
+
+				// Wait for the source holding the merge back, but no longer than until it stalls.
+				std::chrono::steady_clock::time_point waitUntil = deadline;
+				if (pWaitFor != nullptr) {
+					waitUntil = std::min(deadline, pWaitFor -> lastArrival + maxLag);
+				} else {
+					waitUntil = std::min(deadline, now + std::chrono::milliseconds(1));
+				}
+
+				if (pWaitFor != nullptr) {
+					CRingItem *pSourceItem = nullptr;
+					std::chrono::milliseconds waitTime = std::chrono::duration_cast<std::chrono::milliseconds>(waitUntil - now) + std::chrono::milliseconds(1);
+					if (pWaitFor -> reader -> getItem(pSourceItem, waitTime) && read(indexOf(pWaitFor), pSourceItem)) {
+						pItem = pendingItem;
+						pendingItem = nullptr;
+
+						return ITEM;
+					}
+				} else {
+					std::this_thread::sleep_until(waitUntil);
+				}
+			}
+		};
+
+	private:
+		struct Source {
+			std::unique_ptr<CThreadedDataSource> reader;
+			int64_t clockOffset = 0;
+
+			bool     timeSet         = false;
+			uint64_t prevTimestamp   = 0;
+			uint64_t rolloverCounter = 0;
+
+			bool       hasHead = false;
+			MDPPSCPSRO head;
+
+			uint64_t numRunsEnded = 0;  // end of run items seen
+			bool isExhausted = false; // no more items ever
+			std::chrono::steady_clock::time_point lastArrival; // of the last hit or end of data
+		};
+
+		/**
+		 * read
+		 *    Takes an item read from source index. Hits become the head of the source.
+		 *
+		 * @return true if the item is to be passed on right away. It is left in pendingItem.
+		 */
+		bool read(size_t index, CRingItem *pItem) {
+			// Only hits and the end of data keep a source from stalling; one sending nothing but
+			// scalers holds no hits for the merge to wait for.
+			Source &source = *sources[index];
+			if (pItem == nullptr || pItem -> type() == PHYSICS_EVENT || pItem -> type() == END_RUN || pItem -> type() == ABNORMAL_ENDRUN) {
+				source.lastArrival = std::chrono::steady_clock::now();
+			}
+
+			if (pItem == nullptr) {
+				source.isExhausted = true;
+
+				return false;
+			}
+
+			if (pItem -> type() == PHYSICS_EVENT) {
+				unpack(*pItem, source.head);
+
+				uint64_t absoluteTimestamp = absolute(source, source.head);
+				source.head.rollovercounter = absoluteTimestamp >> TIMESTAMP_BITS;
+				source.head.timestamp       = absoluteTimestamp & TIMESTAMP_MASK;
+				source.hasHead = true;
+
+				heads.push(std::make_pair(absoluteTimestamp, index));
+
+				return false;
+			}
+
+			if (pItem -> type() == END_RUN || pItem -> type() == ABNORMAL_ENDRUN) {
+				source.numRunsEnded++;
+
+				// The run may have been ended without this source while it stalled.
+				if (index == 0 && !isHeld(source)) {
+					pendingItem = pItem;
+
+					return true;
+				} else if (index == 0) {
+					endRunItem = pItem;
+				} else {
+					delete pItem;
+				}
+
+				return false;
+			}
+
+			if (index != 0) {
+				delete pItem;
+
+				return false;
+			}
+
+			pendingItem = pItem;
+
+			return true;
+		};
+
+		// Absolute timestamp of a hit with the rollover counter of its source and the clock offset.
+		uint64_t absolute(Source &source, const MDPPSCPSRO &hit) {
+			if (source.timeSet && hit.timestamp < source.prevTimestamp
+			    && source.prevTimestamp > TIMESTAMP_MASK/2 && hit.timestamp < TIMESTAMP_MASK/2) {
+				source.rolloverCounter++;
+			}
+			source.prevTimestamp = hit.timestamp;
+			source.timeSet = true;
+
+			int64_t absoluteTimestamp = static_cast<int64_t>((source.rolloverCounter << TIMESTAMP_BITS) | hit.timestamp) + source.clockOffset;
+
+			return absoluteTimestamp < 0 ? 0 : absoluteTimestamp;
+		};
+
+		size_t indexOf(Source *pSource) {
+			for (size_t i = 0; i < sources.size(); i++) {
+				if (sources[i].get() == pSource) {
+					return i;
+				}
+			}
+
+			return 0;
+		};
+
+		// A source that ended the current run waits for the others before it's read on.
+		// One whose end of run came after the run was ended without it is not held back.
+		bool isHeld(const Source &source) const {
+			return source.numRunsEnded > numRunsEnded;
+		};
+
+		// A stalled source doesn't hold the end of run back, but some source must have ended it.
+		bool allEnded() {
+			bool isAnyHeld = false;
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			for (auto &source : sources) {
+				if (!isHeld(*source) && !source -> isExhausted && now - source -> lastArrival < maxLag) {
+					return false;
+				}
+
+				isAnyHeld = isAnyHeld || isHeld(*source);
+			}
+
+			return isAnyHeld;
+		};
+
+		bool allExhausted() {
+			for (auto &source : sources) {
+				if (!source -> isExhausted) {
+					return false;
+				}
+			}
+
+			return true;
+		};
+
+	private:
+		static const int      TIMESTAMP_BITS = 46;
+		static const uint64_t TIMESTAMP_MASK = 0x3FFFFFFFFFFF;
+
+		std::function<void(CRingItem &, MDPPSCPSRO &)> unpack;
+		std::chrono::milliseconds maxLag;
+
+		std::vector<std::unique_ptr<Source>> sources;
+		std::priority_queue<std::pair<uint64_t, size_t>, std::vector<std::pair<uint64_t, size_t>>, std::greater<std::pair<uint64_t, size_t>>> heads;
+
+		CRingItem *pendingItem = nullptr;
+		CRingItem *endRunItem  = nullptr;
+		uint64_t numRunsEnded  = 0; // end of run released
+};
+
+#endif
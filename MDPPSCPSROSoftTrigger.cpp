@@ -20,6 +20,7 @@
 #include <CDataSinkFactory.h>   // Turn a URI into a concrete data sink.
 #include <CRingItem.h>          // Base class for ring items.
 #include <CPhysicsEventItem.h>  // CPhysicsEventItem class for PHYSICS_EVENT items.
+#include <CRingScalerItem.h>    // CRingScalerItem class for PERIODIC_SCALERS items.
 #include <DataFormat.h>         // Ring item data formats.
 #include <Exception.h>          // Base class for exception handling.
 
@@ -27,13 +28,33 @@
 #include <iostream>
 #include <cstring>
 #include <cstdlib>
+#include <cerrno>
 #include <memory>
 #include <vector>
 #include <cstdint>
 #include <queue>
-#include <deque>
+#include <string>
+#include <sstream>
+#include <map>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <getopt.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "MDPPSCPSRO.h"
+#include "CNullDataSink.h"
+#include "CThreadedDataSource.h"
+#include "MDPPSCPSROHitRing.h"
+#include "MDPPSCPSROMerger.h"
+#include "MDPPSCPSROIndex.h"
+#include "MDPPSCPSROCalibrator.h"
 
 //double                 MDPP_TDC_UNIT = 24.41; // ps
 double                 MDPP_TDC_UNIT = 781.25; // ps
@@ -46,7 +67,6 @@ double    REVERSED_TEST_THRESHOLD_NS = 10; // ns
 //#define DEBUG
 
 using std::queue;
-using std::deque;
 using std::cout;
 using std::cerr;
 using std::endl;
@@ -65,6 +85,7 @@ uint64_t latestAbsoluteMdppTimestamp    = 0;
   double latestAbsoluteMdppTimestamp_ns = 0;
 
 uint64_t  mdppRolloverCounter = 0;
+    bool  isMerged = false; // hits come with the rollover counter of their source from the merger
 
 	double refDiff_ns = 0;
 
@@ -84,29 +105,48 @@ uint64_t  windowWidth    = 0; // derived from ns approx value in MDPP_TDC_UNIT
   double    windowEndTimestamp_ns = 0;
 uint64_t  windowStartTimestamp    = 0;
 uint64_t    windowEndTimestamp    = 0;
+uint64_t      triggerTimestamp    = 0;
 
-deque<MDPPSCPSRO *> hitDeque;
-queue<MDPPSCPSRO *> eventQueue;
+uint32_t  sourceId    = 0; // body header of output physics events
+uint32_t  barrierType = 0;
+
+MDPPSCPSROHitRing hitRing;
+std::vector<MDPPSCPSRO> eventQueue;
 queue<CPhysicsEventItem *> rfQueue;
 
+uint64_t  numTriggers      = 0; // trigger windows opened
+uint64_t  numCollections   = 0; // trigger windows sent
+uint64_t  numCollectedHits = 0; // hits sent inside trigger windows
+uint64_t  numPassedHits    = 0; // hits sent outside trigger windows
+
+std::unique_ptr<MDPPSCPSROCalibrator> pCalibrator;
+uint64_t  calibrationTriggers    = 0; // triggers before applying the calibration, 0 for reporting only
+uint64_t  nextCalibrationAttempt = 0; // triggers at which the calibration is tried next
+
 	public:
-uint64_t getMdppTimestamp(MDPPSCPSRO &anEvent);
-double getMdppTimestamp_ns(MDPPSCPSRO &anEvent);
-uint64_t getAbsoluteMdppTimestamp(MDPPSCPSRO &anEvent);
-double getAbsoluteMdppTimestamp_ns(MDPPSCPSRO &anEvent);
-MDPPSCPSRO &unpack(CRingItem &item);
-CPhysicsEventItem *pack(MDPPSCPSRO &anEvent);
+void setWindow(int trigCh, double winStart_ns, double winWidth_ns);
+void processEvent(CDataSink &sink, const MDPPSCPSRO &anEvent);
+void advanceWatermark(CDataSink &sink, uint64_t watermark);
+void printSummary(std::ostream &o);
+bool applyCalibration();
+void printCalibration(std::ostream &o);
+uint64_t getMdppTimestamp(const MDPPSCPSRO &anEvent);
+double getMdppTimestamp_ns(const MDPPSCPSRO &anEvent);
+uint64_t getAbsoluteMdppTimestamp(const MDPPSCPSRO &anEvent);
+double getAbsoluteMdppTimestamp_ns(const MDPPSCPSRO &anEvent);
+void unpack(CRingItem &item, MDPPSCPSRO &anEvent);
+CPhysicsEventItem *pack(const MDPPSCPSRO &anEvent);
 void send(CDataSink &sink, CRingItem &item);
 void updateTimestamps(MDPPSCPSRO &anEvent);
-MDPPSCPSRO &getLastEvent();
-MDPPSCPSRO &getFirstEvent();
-MDPPSCPSRO &peekFirstEvent();
-void collectEvent(MDPPSCPSRO &anEvent);
+void passHits(CDataSink &sink, size_t numHits);
+void collectHits(size_t numHits);
+void collectEvent(const MDPPSCPSRO &anEvent);
 void sendCollection(CDataSink &sink);
 void updateTriggerWindow(MDPPSCPSRO &triggerEvent);
 void sending(CDataSink &sink, bool isTriggerChannel);
 void emptyingQueues(CDataSink &sink);
 void flushRFQueue(CDataSink &sink);
+void markIndex(CDataSink &sink, uint64_t timestamp);
 };
 
 /**
@@ -121,7 +161,10 @@ void usage(std::ostream &o, const char *msg, const char *program)
 {
 	o << msg << std::endl;
 	o << "= Usage:\n";
-	o << "  " << program << " inRingURI outRingURI trigCh winStart winWidth [cut3s] [rfCh]\n";
+	o << "  " << program << " [options] inRingURI outRingURI trigCh winStart winWidth [cut3s] [rfCh]\n";
+	o << "  " << program << " [options] --scan=scanList inRingURI [cut3s] [rfCh]\n";
+	o << "  " << program << " [options] --batch=batchList trigCh winStart winWidth [cut3s] [rfCh]\n";
+	o << "  " << program << " [options] --batch-dir=dir --output-template=template trigCh winStart winWidth [cut3s] [rfCh]\n";
 	o << "        inRingURI - the file: or tcp: URI that describes where data comes from\n";
 	o << "       outRingURI - the file: or tcp: URI that describes where data goes out to\n";
 	o << "           trigCh - a channel number to create trigger window\n";
@@ -140,37 +183,81 @@ void usage(std::ostream &o, const char *msg, const char *program)
 	o << "       If an RF channel is specified, the program won't pass the events until the first RF\n";
 	o << "       channel signal is detected. Once the channel data is detected, it keeps the data in\n";
 	o << "       the buffer until the next RF channel data is detected. If not, the buffer is flushed.\n";
+	o << "\n";
+	o << "     About scan\n";
+	o << "       With --scan, every line of scanList gives one trigger setting as\n";
+	o << "         trigCh winStart winWidth [outRingURI]\n";
+	o << "       and all settings are evaluated in one pass over inRingURI. Each hit is decoded once\n";
+	o << "       and fed to every setting. A setting without outRingURI only reports its summary.\n";
+	o << "       Lines starting with # are ignored.\n";
+	o << "\n";
+	o << "     About batch\n";
+	o << "       With --batch, every line of batchList is \"input output\" and all pairs are converted with\n";
+	o << "       the same trigger setting. Plain paths are taken as files. With --batch-dir, every .evt file\n";
+	o << "       in dir is converted to template with %s replaced by the file name without .evt, e.g.\n";
+	o << "         --batch-dir=stagearea --output-template=stagearea/conversion/%s_softtrig.evt\n";
+	o << "       Conversions run in --jobs=N worker processes (default: number of CPUs) which get all\n";
+	o << "       the other options. The exit status is non-zero when any file failed, and those are listed.\n";
+	o << "\n";
+	o << "     Options (must come before the positional arguments)\n";
+	o << "       --idle-timeout=ms  - When no hit has arrived for ms of wall-clock time, assume the MDPP clock\n";
+	o << "                            kept running and close trigger windows and flush hits up to that time.\n";
+	o << "                            Bounds the output latency on quiet channels and during beam-off.\n";
+	o << "       --idle-margin=ms   - Readout latency allowance for --idle-timeout and --scaler-watermark\n";
+	o << "                            (default 1000, the VMUSB buffer timeout). The flush stays ms behind\n";
+	o << "                            so that hits still buffered in the controller are not overtaken.\n";
+	o << "       --scaler-watermark - Close trigger windows and flush hits up to the end time of every\n";
+	o << "                            scaler item less the idle margin. Assumes the MDPP timestamp is\n";
+	o << "                            reset at the run start.\n";
+	o << "       With rfCh, data still waits for the next RF channel signal after being released.\n";
+	o << "       --source-id=id     - Source ID in the body header of every output physics event (default 0).\n";
+	o << "       --barrier=type     - Barrier type in the body header of every output physics event (default 0).\n";
+	o << "                            The body header timestamp is the absolute MDPP timestamp of the hit,\n";
+	o << "                            or of the trigger hit for a trigger window.\n";
+	o << "       --input=URI        - Another source merged in time order with inRingURI. Repeatable.\n";
+	o << "                            Sources are numbered from 0 for inRingURI in the given order.\n";
+	o << "                            Only non-physics items of inRingURI are passed on.\n";
+	o << "       --clock-offset=n:ns- Added to the timestamps of source n before merging. Repeatable.\n";
+	o << "       --max-lag=ms       - A source with nothing for ms of wall-clock time no longer holds\n";
+	o << "                            the merge back (default 2000).\n";
+	o << "       --index=ms         - Write a time index next to every file: output as <file>.idx, with\n";
+	o << "                            an entry every ms of data time and at every trigger window or RF flush.\n";
+	o << "                            MDPPSCPSROIndexReader in MDPPSCPSROIndex.h reads it.\n";
+	o << "       --calibrate        - Histogram (hit time - trigger channel time) of every channel while\n";
+	o << "                            running and report the coincidence peak of each channel and the\n";
+	o << "                            suggested winStart and winWidth at every end of run.\n";
+	o << "       --calibrate-range=ns - Largest |hit time - trigger time| histogrammed (default 100000).\n";
+	o << "       --calibrate-bin=ns - Histogram bin width (default 100).\n";
+	o << "       --calibrate-apply=n- Replace winStart and winWidth by the suggestion once n triggers are seen.\n";
+	o << "                            Without a peak yet, it is tried again every n triggers.\n";
 
 	std::exit(EXIT_FAILURE);
 }
 
-uint64_t MDPPSCPSROSoftTrigger::getMdppTimestamp(MDPPSCPSRO &anEvent)
+uint64_t MDPPSCPSROSoftTrigger::getMdppTimestamp(const MDPPSCPSRO &anEvent)
 {
 	return anEvent.timestamp;
 }
 
-double MDPPSCPSROSoftTrigger::getMdppTimestamp_ns(MDPPSCPSRO &anEvent)
+double MDPPSCPSROSoftTrigger::getMdppTimestamp_ns(const MDPPSCPSRO &anEvent)
 {
 	return static_cast<double>(anEvent.timestamp)*MDPP_TDC_UNIT/1000.;
 }
 
-uint64_t MDPPSCPSROSoftTrigger::getAbsoluteMdppTimestamp(MDPPSCPSRO &anEvent)
+uint64_t MDPPSCPSROSoftTrigger::getAbsoluteMdppTimestamp(const MDPPSCPSRO &anEvent)
 {
 	uint64_t absoluteMdppTimestamp = (anEvent.rollovercounter << 46) | getMdppTimestamp(anEvent);
 	return absoluteMdppTimestamp;
 }
 
-double MDPPSCPSROSoftTrigger::getAbsoluteMdppTimestamp_ns(MDPPSCPSRO &anEvent)
+double MDPPSCPSROSoftTrigger::getAbsoluteMdppTimestamp_ns(const MDPPSCPSRO &anEvent)
 {
 	return static_cast<double>(getAbsoluteMdppTimestamp(anEvent))*MDPP_TDC_UNIT/1000.;
 }
 
-MDPPSCPSRO &MDPPSCPSROSoftTrigger::unpack(CRingItem &item) {
+void MDPPSCPSROSoftTrigger::unpack(CRingItem &item, MDPPSCPSRO &anEvent) {
 	std::unique_ptr<CRingItem> pItem(&item);
 
-	MDPPSCPSRO *pAnEvent = new MDPPSCPSRO();
-	MDPPSCPSRO &anEvent = *pAnEvent;
-
 	void *p = item.getBodyPointer();
 
 	uint16_t *vmusbHeader = reinterpret_cast<uint16_t *>(p);
@@ -195,7 +282,7 @@ MDPPSCPSRO &MDPPSCPSROSoftTrigger::unpack(CRingItem &item) {
 	if (header != 1) {
 		anEvent.moduleid = -1;
 
-		return anEvent;
+		return;
 	}
 
 	anEvent.moduleid      = (*a32BitItem &    0xFF0000) >> 16;
@@ -211,7 +298,7 @@ MDPPSCPSRO &MDPPSCPSROSoftTrigger::unpack(CRingItem &item) {
 	if (!dataChecker) {
 		anEvent.moduleid = -1;
 
-		return anEvent;
+		return;
 	}
 
 	anEvent.pileup   = (*a32BitItem   &  0x1000000) >> 18;
@@ -235,7 +322,7 @@ MDPPSCPSRO &MDPPSCPSROSoftTrigger::unpack(CRingItem &item) {
 	if (!dataChecker) {
 		anEvent.moduleid = -1;
 
-		return anEvent;
+		return;
 	}
 
 	anEvent.timestamp = (static_cast<uint64_t>(*a32BitItem & 0xFFFF) << 30);
@@ -248,7 +335,7 @@ MDPPSCPSRO &MDPPSCPSROSoftTrigger::unpack(CRingItem &item) {
 	if (!dataChecker) {
 		anEvent.moduleid = -1;
 
-		return anEvent;
+		return;
 	}
 
 	anEvent.timestamp |= (*a32BitItem & 0x3FFFFFFF);
@@ -256,15 +343,13 @@ MDPPSCPSRO &MDPPSCPSROSoftTrigger::unpack(CRingItem &item) {
 #ifdef DEBUG
 	cout << "timestamp: " << anEvent.timestamp << endl;
 #endif
-
-	return anEvent;
 }
 
-CPhysicsEventItem *MDPPSCPSROSoftTrigger::pack(MDPPSCPSRO &anEvent)
+CPhysicsEventItem *MDPPSCPSROSoftTrigger::pack(const MDPPSCPSRO &anEvent)
 {
-	std::unique_ptr<MDPPSCPSRO> pAnEvent(&anEvent);
+	numPassedHits++;
 
-	CPhysicsEventItem *newItem = new CPhysicsEventItem();
+	CPhysicsEventItem *newItem = new CPhysicsEventItem(getAbsoluteMdppTimestamp(anEvent), sourceId, barrierType);
 
 	void *dest = newItem -> getBodyCursor();
 
@@ -331,6 +416,15 @@ void MDPPSCPSROSoftTrigger::updateTimestamps(MDPPSCPSRO &anEvent)
 	prevMdppTimestamp_ns = mdppTimestamp_ns;
 			mdppTimestamp_ns = getMdppTimestamp_ns(anEvent);
 	double mdppTimestampDiff_ns = mdppTimestamp_ns - prevMdppTimestamp_ns;
+	if (isMerged) {
+		latestAbsoluteMdppTimestamp    = timeSet ? std::max(getAbsoluteMdppTimestamp(anEvent), latestAbsoluteMdppTimestamp) : getAbsoluteMdppTimestamp(anEvent);
+		latestAbsoluteMdppTimestamp_ns = timeSet ? std::max(getAbsoluteMdppTimestamp_ns(anEvent), latestAbsoluteMdppTimestamp_ns) : getAbsoluteMdppTimestamp_ns(anEvent);
+
+		timeSet = true;
+
+		return;
+	}
+
 	if (!timeSet) {
 		mdppTimestampDiff_ns = 0;
 
@@ -373,40 +467,54 @@ void MDPPSCPSROSoftTrigger::updateTimestamps(MDPPSCPSRO &anEvent)
 #endif
 }
 
-MDPPSCPSRO &MDPPSCPSROSoftTrigger::getLastEvent()
+/**
+ * passHits
+ *    Sends the numHits oldest hits out one by one, outside of any trigger window.
+ */
+void MDPPSCPSROSoftTrigger::passHits(CDataSink &sink, size_t numHits)
 {
-	MDPPSCPSRO *pAnEvent = hitDeque.back();
-	hitDeque.pop_back();
+	for (size_t i = 0; i < numHits; i++) {
+		CPhysicsEventItem &packedEvent = *pack(hitRing[i]);
+		if (rfChannel != -1) {
+			rfQueue.push(&packedEvent);
+		} else {
+			send(sink, packedEvent);
+		}
+	}
 
-	return *pAnEvent;
+	hitRing.popFront(numHits);
 }
 
-MDPPSCPSRO &MDPPSCPSROSoftTrigger::getFirstEvent()
+/**
+ * collectHits
+ *    Moves the numHits oldest hits into the trigger window being collected.
+ */
+void MDPPSCPSROSoftTrigger::collectHits(size_t numHits)
 {
-	MDPPSCPSRO *pAnEvent = hitDeque.front();
-	hitDeque.pop_front();
+	if (numHits == 0) {
+		return;
+	}
 
-	return *pAnEvent;
-}
+	hitRing.copyFront(numHits, eventQueue);
+	hitRing.popFront(numHits);
+	numCollectedHits += numHits;
 
-MDPPSCPSRO &MDPPSCPSROSoftTrigger::peekFirstEvent()
-{
-	return *hitDeque.front();
+	dataCollecting = true;
 }
 
-void MDPPSCPSROSoftTrigger::collectEvent(MDPPSCPSRO &anEvent)
+void MDPPSCPSROSoftTrigger::collectEvent(const MDPPSCPSRO &anEvent)
 {
-	eventQueue.push(&anEvent);
+	eventQueue.push_back(anEvent);
+	numCollectedHits++;
 
 	dataCollecting = true;
 }
 
 void MDPPSCPSROSoftTrigger::sendCollection(CDataSink &sink)
 {
-	MDPPSCPSRO &anEvent = *eventQueue.front();
+	MDPPSCPSRO &anEvent = eventQueue.front();
 
-//	CPhysicsEventItem *pNewItem = new CPhysicsEventItem(anEvent.eventtimestamp, anEvent.sourceid, 0, 8192);
-	CPhysicsEventItem *pNewItem = new CPhysicsEventItem();
+	CPhysicsEventItem *pNewItem = new CPhysicsEventItem(triggerTimestamp, sourceId, barrierType);
 	CPhysicsEventItem &newItem = *pNewItem;
 
 	void *dest = newItem.getBodyCursor();
@@ -417,10 +525,7 @@ void MDPPSCPSROSoftTrigger::sendCollection(CDataSink &sink)
 	std::memcpy(dest, &vmusbHeader, 2);
 	dest = static_cast<void *>(static_cast<uint8_t *>(dest) + 2);
 
-	while (!eventQueue.empty()) {
-    std::unique_ptr<MDPPSCPSRO> pAnEvent(eventQueue.front());
-		MDPPSCPSRO &anEvent = *pAnEvent;
-
+	for (auto &anEvent : eventQueue) {
 		uint64_t headerItem = (0x1                              << 30)
 												| ((anEvent.moduleid      &   0xFF) << 16)
 											 	| ((anEvent.tdcresolution &    0x7) << 13)
@@ -450,9 +555,8 @@ void MDPPSCPSROSoftTrigger::sendCollection(CDataSink &sink)
 
 		std::memcpy(dest, &timestampLowItem, 4);
 		dest = static_cast<void *>(static_cast<uint8_t *>(dest) + 4);
-
-		eventQueue.pop();
 	}
+	eventQueue.clear();
 
 	uint64_t ender = 0xFFFFFFFF;
 
@@ -468,14 +572,17 @@ void MDPPSCPSROSoftTrigger::sendCollection(CDataSink &sink)
 	if (rfChannel != -1) {
 		rfQueue.push(&newItem);
 	} else {
+		markIndex(sink, triggerTimestamp);
 		send(sink, newItem);
 	}
+	numCollections++;
 
 	dataCollecting = false;
 }
 
 void MDPPSCPSROSoftTrigger::updateTriggerWindow(MDPPSCPSRO &triggerEvent)
 {
+	triggerTimestamp        = getAbsoluteMdppTimestamp(triggerEvent);
 	windowStartTimestamp    = getAbsoluteMdppTimestamp(triggerEvent) - windowStart;
 	windowStartTimestamp_ns = static_cast<double>(windowStartTimestamp)*MDPP_TDC_UNIT/1000.;
 	if (getAbsoluteMdppTimestamp(triggerEvent) < windowStart) {
@@ -489,53 +596,44 @@ void MDPPSCPSROSoftTrigger::updateTriggerWindow(MDPPSCPSRO &triggerEvent)
 void MDPPSCPSROSoftTrigger::sending(CDataSink &sink, bool isTriggerChannel)
 {
 	if (isTriggerChannel && !dataCollecting) {
-		MDPPSCPSRO &triggerEvent = getLastEvent();
+		// The trigger hit is the newest one, or next to it when its order was reversed.
+		size_t triggerIndex = hitRing.size() - 1;
+		while (triggerIndex > 0 && hitRing[triggerIndex].ch != triggerChannel) {
+			triggerIndex--;
+		}
+
+		MDPPSCPSRO triggerEvent = hitRing[triggerIndex];
+		hitRing.erase(triggerIndex);
 
 		updateTriggerWindow(triggerEvent);
 
 #ifdef DEBUG
 				cout << "== New trigger event detected ==" << endl;
-				cout << "                           hitDeque size: " << hitDeque.size() << endl;
+				cout << "                            hitRing size: " << hitRing.size() << endl;
 				cout << "            Window start timestamp in ns: " << windowStartTimestamp_ns << " (" << windowStartTimestamp << ")" << endl;
 				cout << "           MDPP absolute timestamp in ns: " << getAbsoluteMdppTimestamp_ns(triggerEvent) << " (" << getAbsoluteMdppTimestamp(triggerEvent) << ")" << endl;
 #endif
 
-		while (!hitDeque.empty()) {
-			MDPPSCPSRO &anEvent = getFirstEvent();
+		size_t numBeforeWindow = hitRing.lowerBound(windowStartTimestamp);
+		size_t numToWindowEnd  = hitRing.upperBound(windowEndTimestamp);
 
-			if (getAbsoluteMdppTimestamp(anEvent) >= windowStartTimestamp && getAbsoluteMdppTimestamp(anEvent) <= windowEndTimestamp)
-		 	{
 #ifdef DEBUG
-				cout << "== Collected before trigger event ==" << endl;
-				cout << "  MDPP timestamp from window start in ns: " << getAbsoluteMdppTimestamp_ns(anEvent) - windowStartTimestamp_ns << " (" << getAbsoluteMdppTimestamp(anEvent) - windowStartTimestamp << ")" << endl;
+				cout << "== Flushing " << numBeforeWindow << " before window start events ==" << endl;
+				cout << "== Collected " << numToWindowEnd - numBeforeWindow << " before trigger events ==" << endl;
 #endif
-				collectEvent(anEvent);
-			}
-			else if (getAbsoluteMdppTimestamp(anEvent) < windowStartTimestamp)
-			{
-#ifdef DEBUG
-				cout << "== Flushing before window start event ==" << endl;
-				cout << "            Window start timestamp in ns: " << windowStartTimestamp_ns << " (" << windowStartTimestamp << ")" << endl;
-				cout << "                    MDPP timestamp in ns: " << getAbsoluteMdppTimestamp_ns(anEvent) << " (" << getAbsoluteMdppTimestamp(anEvent) << ")" << endl;
-#endif
-				CPhysicsEventItem &packedEvent = *pack(anEvent);
-				if (rfChannel != -1) {
-					rfQueue.push(&packedEvent);
-				} else {
-					send(sink, packedEvent);
-				}
-			}
-		 	else 
-			{
-				cerr << "== This shouldn't be happening! 1 ==" << endl;
-				cerr << "  MDPP timestamp from window start in ns: " << getAbsoluteMdppTimestamp_ns(anEvent) - windowStartTimestamp_ns << " (" << getAbsoluteMdppTimestamp(anEvent) - windowStartTimestamp << ")" << endl;
-				cerr << "                      Window start in ns: " << windowStartTimestamp_ns << " (" << windowStartTimestamp << ")" << endl;
-				cout << "           MDPP absolute timestamp in ns: " << getAbsoluteMdppTimestamp_ns(triggerEvent) << " (" << getAbsoluteMdppTimestamp(triggerEvent) << ")" << endl;
-				cerr << "                   MDPP rollover counter: " << anEvent.rollovercounter << endl;
-				cerr << "                          MDPP timestamp: " << anEvent.timestamp << endl;
 
-				break;
-			}
+		passHits(sink, numBeforeWindow);
+		collectHits(numToWindowEnd - numBeforeWindow);
+
+		if (!hitRing.empty()) {
+			MDPPSCPSRO &anEvent = hitRing.front();
+
+			cerr << "== This shouldn't be happening! 1 ==" << endl;
+			cerr << "  MDPP timestamp from window start in ns: " << getAbsoluteMdppTimestamp_ns(anEvent) - windowStartTimestamp_ns << " (" << getAbsoluteMdppTimestamp(anEvent) - windowStartTimestamp << ")" << endl;
+			cerr << "                      Window start in ns: " << windowStartTimestamp_ns << " (" << windowStartTimestamp << ")" << endl;
+			cout << "           MDPP absolute timestamp in ns: " << getAbsoluteMdppTimestamp_ns(triggerEvent) << " (" << getAbsoluteMdppTimestamp(triggerEvent) << ")" << endl;
+			cerr << "                   MDPP rollover counter: " << anEvent.rollovercounter << endl;
+			cerr << "                          MDPP timestamp: " << anEvent.timestamp << endl;
 		}
 
 #ifdef DEBUG
@@ -545,29 +643,20 @@ void MDPPSCPSROSoftTrigger::sending(CDataSink &sink, bool isTriggerChannel)
 #endif
 
 		collectEvent(triggerEvent);
+		numTriggers++;
 	} else if (dataCollecting) {
-		MDPPSCPSRO &anEvent = peekFirstEvent();
+		// Hits older than the window can't be in any window anymore.
+		passHits(sink, hitRing.lowerBound(windowStartTimestamp));
+		collectHits(hitRing.upperBound(windowEndTimestamp));
 
 #ifdef DEBUG
 				cout << "== Collecting? ==" << endl;
-				cout << "  MDPP timestamp from window start in ns: " << getAbsoluteMdppTimestamp_ns(anEvent) - windowStartTimestamp_ns << " (" << getAbsoluteMdppTimestamp(anEvent) - windowStartTimestamp << ")" << endl;
-				cout << "                    MDPP timestamp in ns: " << getAbsoluteMdppTimestamp_ns(anEvent) << " (" << getAbsoluteMdppTimestamp(anEvent) << ")" << endl;
 				cout << "             windowStart timestamp in ns: " << windowStartTimestamp_ns << " (" << windowStartTimestamp << ")" << endl;
 				cout << "               windowEnd timestamp in ns: " << windowEndTimestamp_ns << " (" << windowEndTimestamp << ")" << endl;
-#endif
-		if (getAbsoluteMdppTimestamp(anEvent) >= windowStartTimestamp && getAbsoluteMdppTimestamp(anEvent) <= windowEndTimestamp)
-		{
-			anEvent = getFirstEvent();
-
-#ifdef DEBUG
-				cout << "== Collected after trigger event ==" << endl;
-				cout << "  MDPP timestamp from window start in ns: " << getAbsoluteMdppTimestamp_ns(anEvent) - windowStartTimestamp_ns << " (" << getAbsoluteMdppTimestamp(anEvent) - windowStartTimestamp << ")" << endl;
-				cout << "                    MDPP timestamp in ns: " << getAbsoluteMdppTimestamp_ns(anEvent) << " (" << getAbsoluteMdppTimestamp(anEvent) << ")" << endl;
+				cout << "                  latest timestamp in ns: " << latestAbsoluteMdppTimestamp_ns << " (" << latestAbsoluteMdppTimestamp << ")" << endl;
 #endif
 
-			collectEvent(anEvent);
-		}
-		else if (windowEndTimestamp < latestAbsoluteMdppTimestamp)
+		if (windowEndTimestamp < latestAbsoluteMdppTimestamp)
 		{
 #ifdef DEBUG
 				cout << "== Collecting done! Sending ==" << endl;
@@ -578,39 +667,16 @@ void MDPPSCPSROSoftTrigger::sending(CDataSink &sink, bool isTriggerChannel)
 				cout << "== Checking if there's trigger event left ==" << endl;
 #endif
 
-			sending(sink, anEvent.ch == triggerChannel);
-		}
-		else
-		{
-			cerr << "== This shouldn't be happening! 2 ==" << endl;
-			cerr << "  MDPP timestamp from window start in ns: " << getAbsoluteMdppTimestamp_ns(anEvent) - windowStartTimestamp_ns << " (" << getAbsoluteMdppTimestamp(anEvent) - windowStartTimestamp << ")" << endl;
-			cerr << "                      Window start in ns: " << windowStartTimestamp_ns << " (" << windowStartTimestamp << ")" << endl;
-			cerr << "           MDPP absolute timestamp in ns: " << getAbsoluteMdppTimestamp_ns(anEvent) << " (" << getAbsoluteMdppTimestamp(anEvent) << ")" << endl;
-			cerr << "                   MDPP rollover counter: " << anEvent.rollovercounter << endl;
-			cerr << "                          MDPP timestamp: " << anEvent.timestamp << endl;
+			if (!hitRing.empty()) {
+				sending(sink, isTriggerChannel);
+			}
 		}
-	}	else {
-		while (!hitDeque.empty()) {
-			MDPPSCPSRO &anEvent = peekFirstEvent();
-
-			if (latestAbsoluteMdppTimestamp - getAbsoluteMdppTimestamp(anEvent) > windowStart)
-			{
+	}	else if (latestAbsoluteMdppTimestamp > windowStart) {
 #ifdef DEBUG
-				cout << "== Too far from the window start ==" << endl;
-				cout << "                    MDPP timestamp in ns: " << getAbsoluteMdppTimestamp_ns(anEvent) << " (" << getAbsoluteMdppTimestamp(anEvent) << ")" << endl;
+				cout << "== Flushing events too far from the window start ==" << endl;
 				cout << "                  latest timestamp in ns: " << latestAbsoluteMdppTimestamp_ns << " (" << latestAbsoluteMdppTimestamp << ")" << endl;
 #endif
-				anEvent = getFirstEvent();
-				CPhysicsEventItem &packedEvent = *pack(anEvent);
-				if (rfChannel != -1) {
-					rfQueue.push(&packedEvent);
-				} else {
-					send(sink, packedEvent);
-				}
-			} else {
-				break;
-			}
-		}
+		passHits(sink, hitRing.lowerBound(latestAbsoluteMdppTimestamp - windowStart));
 	}
 }
 
@@ -624,12 +690,7 @@ void MDPPSCPSROSoftTrigger::emptyingQueues(CDataSink &sink)
 			sendCollection(sink);
 		}
 
-		while (!hitDeque.empty()) {
-			MDPPSCPSRO &anEvent = getFirstEvent();
-
-			CPhysicsEventItem &packedEvent = *pack(anEvent);
-			send(sink, packedEvent);
-		}
+		passHits(sink, hitRing.size());
 	} else if (rfChannel != -1 && flushRFQueueRequested) {
 		if (!eventQueue.empty()) {
 			sendCollection(sink);
@@ -644,6 +705,10 @@ void MDPPSCPSROSoftTrigger::flushRFQueue(CDataSink &sink)
 #ifdef DEBUG
 				cout << "== Flushing RF queue by RF leading edge==" << endl;
 #endif
+	if (!rfQueue.empty()) {
+		markIndex(sink, rfQueue.front() -> getEventTimestamp());
+	}
+
 	while (!rfQueue.empty()) {
 		CPhysicsEventItem &packedEvent = *rfQueue.front();
 		rfQueue.pop();
@@ -652,6 +717,442 @@ void MDPPSCPSROSoftTrigger::flushRFQueue(CDataSink &sink)
 	}
 }
 
+// Adds a time index entry for the next item if the sink keeps an index.
+void MDPPSCPSROSoftTrigger::markIndex(CDataSink &sink, uint64_t timestamp)
+{
+	CIndexedDataSink *pIndexedSink = dynamic_cast<CIndexedDataSink *>(&sink);
+	if (pIndexedSink != nullptr) {
+		pIndexedSink -> mark(timestamp);
+	}
+}
+
+void MDPPSCPSROSoftTrigger::setWindow(int trigCh, double winStart_ns, double winWidth_ns)
+{
+	triggerChannel = trigCh;
+	windowStart_ns = winStart_ns;
+	windowWidth_ns = winWidth_ns;
+	windowStart    = windowStart_ns*1000/MDPP_TDC_UNIT;
+	windowWidth    = windowWidth_ns*1000/MDPP_TDC_UNIT;
+}
+
+void MDPPSCPSROSoftTrigger::processEvent(CDataSink &sink, const MDPPSCPSRO &anEvent)
+{
+	if (flushRFQueueRequested && !dataCollecting) {
+		flushRFQueue(sink);
+		flushRFQueueRequested = false;
+	}
+
+	if (rfChannel != -1 && anEvent.ch == rfChannel) {
+		if (dataCollecting) {
+			flushRFQueueRequested = true;
+		} else {
+			flushRFQueue(sink);
+			flushRFQueueRequested = false;
+		}
+	}
+
+	MDPPSCPSRO hit = anEvent;
+	updateTimestamps(hit);
+	hitRing.push(hit, getAbsoluteMdppTimestamp(hit));
+
+	if (pCalibrator) {
+		pCalibrator -> fill(hit, getAbsoluteMdppTimestamp(hit));
+
+		// Without a peak yet, the next try waits for another calibrationTriggers triggers.
+		if (calibrationTriggers > 0 && !dataCollecting && pCalibrator -> getNumTriggers() >= nextCalibrationAttempt) {
+			if (!applyCalibration()) {
+				nextCalibrationAttempt = pCalibrator -> getNumTriggers() + calibrationTriggers;
+			}
+		}
+	}
+
+	sending(sink, hit.ch == triggerChannel);
+}
+
+/**
+ * advanceWatermark
+ *    Declares that no hit older than watermark is expected anymore and releases what waits for it.
+ *    Trigger windows ending before watermark are sent and hits further than windowStart before
+ *    watermark are sent, just as if a hit at watermark had arrived.
+ *    The latest hit timestamp is left as it was, so hits arriving later are triggered as usual.
+ *
+ * @param sink      - where the released items go.
+ * @param watermark - absolute MDPP timestamp in MDPP_TDC_UNIT.
+ */
+void MDPPSCPSROSoftTrigger::advanceWatermark(CDataSink &sink, uint64_t watermark)
+{
+	if (!timeSet || watermark <= latestAbsoluteMdppTimestamp) {
+		return;
+	}
+
+	uint64_t latestHitTimestamp    = latestAbsoluteMdppTimestamp;
+	  double latestHitTimestamp_ns = latestAbsoluteMdppTimestamp_ns;
+
+	latestAbsoluteMdppTimestamp    = watermark;
+	latestAbsoluteMdppTimestamp_ns = static_cast<double>(watermark)*MDPP_TDC_UNIT/1000.;
+
+	sending(sink, false);
+
+	if (flushRFQueueRequested && !dataCollecting) {
+		flushRFQueue(sink);
+		flushRFQueueRequested = false;
+	}
+
+	latestAbsoluteMdppTimestamp    = latestHitTimestamp;
+	latestAbsoluteMdppTimestamp_ns = latestHitTimestamp_ns;
+}
+
+void MDPPSCPSROSoftTrigger::printSummary(std::ostream &o)
+{
+	o << "trigCh " << triggerChannel
+	  << " winStart " << windowStart_ns << " ns"
+	  << " winWidth " << windowWidth_ns << " ns"
+	  << " | triggers: " << numTriggers
+	  << " windows sent: " << numCollections
+	  << " hits in windows: " << numCollectedHits
+	  << " hits outside: " << numPassedHits
+	  << " hits/window: " << (numCollections ? static_cast<double>(numCollectedHits)/numCollections : 0.)
+	  << std::endl;
+}
+
+/**
+ * applyCalibration
+ *    Replaces the trigger window by the one suggested from the calibration histograms.
+ *    The window is only changed once.
+ *
+ * @return false if no channel shows a coincidence peak yet.
+ */
+bool MDPPSCPSROSoftTrigger::applyCalibration()
+{
+	uint64_t suggestedStart, suggestedWidth;
+	if (!pCalibrator -> suggestWindow(suggestedStart, suggestedWidth)) {
+		return false;
+	}
+
+	setWindow(triggerChannel, suggestedStart*MDPP_TDC_UNIT/1000., suggestedWidth*MDPP_TDC_UNIT/1000.);
+	calibrationTriggers = 0;
+
+	cout << "== Calibrated trigger window after " << pCalibrator -> getNumTriggers() << " triggers" << endl;
+	cout << "== Trigger window start (ns): " << windowStart_ns << endl;
+	cout << "== Trigger window width (ns): " << windowWidth_ns << endl;
+
+	return true;
+}
+
+void MDPPSCPSROSoftTrigger::printCalibration(std::ostream &o)
+{
+	o << "== Calibration of trigger channel " << triggerChannel << " from " << pCalibrator -> getNumTriggers() << " triggers" << endl;
+	for (int ch = 0; ch < pCalibrator -> getNumChannels(); ch++) {
+		int64_t low, high;
+		if (ch == triggerChannel || !pCalibrator -> findPeak(ch, low, high)) {
+			continue;
+		}
+
+		double low_ns  = low*MDPP_TDC_UNIT/1000.;
+		double high_ns = high*MDPP_TDC_UNIT/1000.;
+		o << "   Ch " << ch << ": peak in (" << low_ns << ", " << high_ns << ") ns"
+		  << " -> winStart " << std::max(-low_ns, 0.) << " winWidth " << std::max(high_ns, 0.) - std::min(low_ns, 0.) << endl;
+	}
+
+	uint64_t suggestedStart, suggestedWidth;
+	if (pCalibrator -> suggestWindow(suggestedStart, suggestedWidth)) {
+		o << "   All channels: winStart " << suggestedStart*MDPP_TDC_UNIT/1000. << " winWidth " << suggestedWidth*MDPP_TDC_UNIT/1000. << endl;
+	} else {
+		o << "   No coincidence peak found" << endl;
+	}
+
+	if (calibrationTriggers > 0) {
+		o << "   Trigger window not calibrated: no peak at the tries every " << calibrationTriggers << " triggers" << endl;
+	}
+}
+
+/**
+ * readScanList
+ *    Reads the trigger settings of a parameter scan.
+ *    Each non-empty line not starting with # is "trigCh winStart winWidth [outRingURI]".
+ *
+ * @param path      - scan list file.
+ * @param settings  - filled with one engine per line, window already set.
+ * @param outURIs   - filled with the output URI per line, empty if not given.
+ *
+ * @return false if the file cannot be read or a line is malformed.
+ */
+bool readScanList(const char *path, std::vector<MDPPSCPSROSoftTrigger *> &settings, std::vector<std::string> &outURIs)
+{
+	std::ifstream file(path);
+	if (!file) {
+		cerr << "Failed to open scan list: " << path << endl;
+
+		return false;
+	}
+
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(file, line)) {
+		lineNumber++;
+
+		std::istringstream fields(line);
+		std::string first;
+		if (!(fields >> first) || first[0] == '#') {
+			continue;
+		}
+
+		double winStart_ns, winWidth_ns;
+		std::string outURI;
+		if (!(fields >> winStart_ns >> winWidth_ns)) {
+			cerr << "Malformed scan list line " << lineNumber << ": " << line << endl;
+
+			return false;
+		}
+		fields >> outURI;
+
+		MDPPSCPSROSoftTrigger *engine = new MDPPSCPSROSoftTrigger();
+		engine -> setWindow(atoi(first.c_str()), winStart_ns, winWidth_ns);
+
+		settings.push_back(engine);
+		outURIs.push_back(outURI);
+	}
+
+	return true;
+}
+
+/**
+ * toURI
+ *    Turns a plain path into a file: URI. URIs are returned as they are.
+ */
+std::string toURI(const std::string &path)
+{
+	if (path.find("://") != std::string::npos) {
+		return path;
+	}
+
+	if (!path.empty() && path[0] == '/') {
+		return "file://" + path;
+	}
+
+	char workingDirectory[PATH_MAX];
+	if (getcwd(workingDirectory, PATH_MAX) == nullptr) {
+		return "file://" + path;
+	}
+
+	return std::string("file://") + workingDirectory + "/" + path;
+}
+
+/**
+ * readBatchList
+ *    Reads the conversions of a batch. Each non-empty line not starting with # is "input output".
+ *
+ * @return false if the file cannot be read or a line is malformed.
+ */
+bool readBatchList(const char *path, std::vector<std::pair<std::string, std::string>> &conversions)
+{
+	std::ifstream file(path);
+	if (!file) {
+		cerr << "Failed to open batch list: " << path << endl;
+
+		return false;
+	}
+
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(file, line)) {
+		lineNumber++;
+
+		std::istringstream fields(line);
+		std::string input, output;
+		if (!(fields >> input) || input[0] == '#') {
+			continue;
+		}
+
+		if (!(fields >> output)) {
+			cerr << "Malformed batch list line " << lineNumber << ": " << line << endl;
+
+			return false;
+		}
+
+		conversions.emplace_back(toURI(input), toURI(output));
+	}
+
+	return true;
+}
+
+/**
+ * listBatchDirectory
+ *    Makes a conversion of every .evt file in dir, in name order.
+ *    The output is outputTemplate with %s replaced by the file name without .evt.
+ *
+ * @return false if dir cannot be read or outputTemplate has no %s.
+ */
+bool listBatchDirectory(const char *dir, const char *outputTemplate, std::vector<std::pair<std::string, std::string>> &conversions)
+{
+	std::string output(outputTemplate);
+	size_t namePosition = output.find("%s");
+	if (namePosition == std::string::npos) {
+		cerr << "Output template has no %s: " << outputTemplate << endl;
+
+		return false;
+	}
+
+	DIR *pDir = opendir(dir);
+	if (pDir == nullptr) {
+		cerr << "Failed to open batch directory: " << dir << endl;
+
+		return false;
+	}
+
+	std::vector<std::string> names;
+	struct dirent *pEntry;
+	while ((pEntry = readdir(pDir)) != nullptr) {
+		std::string name(pEntry -> d_name);
+		if (name.size() > 4 && name.compare(name.size() - 4, 4, ".evt") == 0) {
+			names.push_back(name);
+		}
+	}
+	closedir(pDir);
+
+	std::sort(names.begin(), names.end());
+	for (auto &name : names) {
+		std::string outputPath(output);
+		outputPath.replace(namePosition, 2, name.substr(0, name.size() - 4));
+
+		conversions.emplace_back(toURI(std::string(dir) + "/" + name), toURI(outputPath));
+	}
+
+	return true;
+}
+
+/**
+ * runBatch
+ *    Converts every pair in conversions by running this program on it in up to numJobs
+ *    worker processes at a time, and reports each file as it finishes.
+ *
+ * @param program     - name the workers are started with.
+ * @param conversions - input and output URI pairs.
+ * @param options     - options given to every worker.
+ * @param settings    - trigCh winStart winWidth [cut3s] [rfCh] given to every worker.
+ * @param numJobs     - number of workers running at once.
+ *
+ * @return number of failed conversions.
+ */
+int runBatch(const char *program, std::vector<std::pair<std::string, std::string>> &conversions, std::vector<std::string> &options, std::vector<std::string> &settings, int numJobs)
+{
+	std::chrono::steady_clock::time_point batchStart = std::chrono::steady_clock::now();
+
+	struct Worker {
+		size_t index;
+		uint64_t inputBytes;
+		std::chrono::steady_clock::time_point start;
+	};
+	std::map<pid_t, Worker> workers;
+
+	std::vector<size_t> failed;
+	size_t   numDone = 0;
+	uint64_t doneBytes = 0;
+	size_t   next = 0;
+
+	while (numDone < conversions.size()) {
+		while (next < conversions.size() && static_cast<int>(workers.size()) < numJobs) {
+			std::vector<std::string> workerArgs;
+			workerArgs.push_back(program);
+			workerArgs.insert(workerArgs.end(), options.begin(), options.end());
+			workerArgs.push_back(conversions[next].first);
+			workerArgs.push_back(conversions[next].second);
+			workerArgs.insert(workerArgs.end(), settings.begin(), settings.end());
+
+			uint64_t inputBytes = 0;
+			struct stat inputStat;
+			const std::string &input = conversions[next].first;
+			if (input.compare(0, 7, "file://") == 0 && stat(input.c_str() + 7, &inputStat) == 0) {
+				inputBytes = inputStat.st_size;
+			}
+
+			pid_t pid = fork();
+			if (pid == 0) {
+				std::vector<char *> execArgs;
+				for (auto &arg : workerArgs) {
+					execArgs.push_back(const_cast<char *>(arg.c_str()));
+				}
+				execArgs.push_back(nullptr);
+
+				// Only the error messages of the workers are shown.
+				if (freopen("/dev/null", "w", stdout) == nullptr) {
+					_exit(EXIT_FAILURE);
+				}
+
+				execv("/proc/self/exe", execArgs.data());
+				_exit(EXIT_FAILURE);
+			} else if (pid < 0) {
+				cerr << "== Failed to start a worker for " << input << endl;
+				failed.push_back(next);
+				numDone++;
+			} else {
+				cout << "== [started] " << input << " -> " << conversions[next].second << endl;
+				workers[pid] = {next, inputBytes, std::chrono::steady_clock::now()};
+			}
+
+			next++;
+		}
+
+		if (workers.empty()) {
+			continue;
+		}
+
+		int status;
+		pid_t pid = wait(&status);
+		if (pid < 0 && errno == EINTR) {
+			continue;
+		}
+
+		// Without wait, nothing more is known: the running and the not started conversions failed.
+		if (pid < 0) {
+			cerr << "== Failed to wait for the workers: " << std::strerror(errno) << endl;
+			for (auto &running : workers) {
+				failed.push_back(running.second.index);
+			}
+			for (; next < conversions.size(); next++) {
+				failed.push_back(next);
+			}
+			break;
+		}
+
+		auto found = workers.find(pid);
+		if (found == workers.end()) {
+			continue;
+		}
+
+		Worker worker = found -> second;
+		workers.erase(found);
+		numDone++;
+
+		double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - worker.start).count();
+		double batchElapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - batchStart).count();
+
+		bool isSuccess = WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+		if (isSuccess) {
+			doneBytes += worker.inputBytes;
+		} else {
+			failed.push_back(worker.index);
+		}
+
+		cout << "== [" << numDone << "/" << conversions.size() << "] "
+		     << (isSuccess ? "done   " : "FAILED ") << conversions[worker.index].first
+		     << " in " << elapsed_s << " s (" << worker.inputBytes/1.0E6/std::max(elapsed_s, 1.0E-9) << " MB/s)"
+		     << " | total " << doneBytes/1.0E6/std::max(batchElapsed_s, 1.0E-9) << " MB/s" << endl;
+	}
+
+	double batchElapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - batchStart).count();
+	cout << endl;
+	cout << "== Batch of " << conversions.size() << " files finished in " << batchElapsed_s << " s, "
+	     << doneBytes/1.0E6 << " MB converted (" << doneBytes/1.0E6/std::max(batchElapsed_s, 1.0E-9) << " MB/s)" << endl;
+
+	std::sort(failed.begin(), failed.end());
+	for (auto index : failed) {
+		cerr << "== Failed: " << conversions[index].first << " -> " << conversions[index].second << endl;
+	}
+
+	return failed.size();
+}
+
 /**
  * The main program:
  *    - Ensures we have a URI parameter (and only a URI parameter).
@@ -664,13 +1165,188 @@ void MDPPSCPSROSoftTrigger::flushRFQueue(CDataSink &sink)
  */
 int main(int argc, char **argv)
 {
-	MDPPSCPSROSoftTrigger *core = new MDPPSCPSROSoftTrigger();
+	const char *scanList = nullptr;
+	int   idleTimeout_ms = 0;
+	int    idleMargin_ms = 1000;
+	bool scalerWatermark = false;
+	uint32_t    sourceId = 0;
+	uint32_t barrierType = 0;
+
+	std::vector<std::string> mergeURIs;
+	std::map<size_t, double> clockOffsets_ns;
+	int            maxLag_ms = 2000;
+	int          indexInterval_ms = 0;
+
+	bool     calibrate = false;
+	double   calibrationRange_ns = 100000;
+	double   calibrationBin_ns   = 100;
+	uint64_t calibrationTriggers = 0;
+
+	const char *batchList      = nullptr;
+	const char *batchDir       = nullptr;
+	const char *outputTemplate = nullptr;
+	int numJobs = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<std::string> workerOptions; // options other than the batch ones, for the batch workers
+
+	static struct option longOptions[] = {
+		{"scan",             required_argument, nullptr, 's'},
+		{"idle-timeout",     required_argument, nullptr, 't'},
+		{"idle-margin",      required_argument, nullptr, 'm'},
+		{"scaler-watermark",       no_argument, nullptr, 'w'},
+		{"source-id",        required_argument, nullptr, 'i'},
+		{"barrier",          required_argument, nullptr, 'r'},
+		{"input",            required_argument, nullptr, 'I'},
+		{"clock-offset",     required_argument, nullptr, 'C'},
+		{"max-lag",          required_argument, nullptr, 'L'},
+		{"index",            required_argument, nullptr, 'x'},
+		{"calibrate",              no_argument, nullptr, 'c'},
+		{"calibrate-range",  required_argument, nullptr, 'R'},
+		{"calibrate-bin",    required_argument, nullptr, 'B'},
+		{"calibrate-apply",  required_argument, nullptr, 'A'},
+		{"batch",            required_argument, nullptr, 'b'},
+		{"batch-dir",        required_argument, nullptr, 'd'},
+		{"output-template",  required_argument, nullptr, 'o'},
+		{"jobs",             required_argument, nullptr, 'j'},
+		{nullptr,                            0, nullptr,   0}
+	};
+
+	// '+' stops at the first positional argument so that rfCh = -1 is not taken as an option.
+	int option;
+	int optionStart = optind;
+	while ((option = getopt_long(argc, argv, "+s:t:m:wi:r:I:C:L:x:cR:B:A:b:d:o:j:", longOptions, nullptr)) != -1) {
+		switch (option) {
+			case 's':
+				scanList = optarg;
+				break;
+			case 't':
+				idleTimeout_ms = atoi(optarg);
+				break;
+			case 'm':
+				idleMargin_ms = atoi(optarg);
+				break;
+			case 'w':
+				scalerWatermark = true;
+				break;
+			case 'i':
+				sourceId = strtoul(optarg, nullptr, 0);
+				break;
+			case 'r':
+				barrierType = strtoul(optarg, nullptr, 0);
+				break;
+			case 'I':
+				mergeURIs.push_back(optarg);
+				break;
+			case 'C':
+				if (std::strchr(optarg, ':') == nullptr) {
+					usage(std::cerr, "--clock-offset needs n:ns", argv[0]);
+				}
+				clockOffsets_ns[atoi(optarg)] = atof(std::strchr(optarg, ':') + 1);
+				break;
+			case 'L':
+				maxLag_ms = atoi(optarg);
+				break;
+			case 'x':
+				indexInterval_ms = atoi(optarg);
+				break;
+			case 'c':
+				calibrate = true;
+				break;
+			case 'R':
+				calibrationRange_ns = atof(optarg);
+				break;
+			case 'B':
+				calibrationBin_ns = atof(optarg);
+				break;
+			case 'A':
+				calibrate = true;
+				calibrationTriggers = strtoull(optarg, nullptr, 0);
+				break;
+			case 'b':
+				batchList = optarg;
+				break;
+			case 'd':
+				batchDir = optarg;
+				break;
+			case 'o':
+				outputTemplate = optarg;
+				break;
+			case 'j':
+				numJobs = std::max(1, atoi(optarg));
+				break;
+			default:
+				usage(std::cerr, "Unknown option", argv[0]);
+		}
+
+		if (std::strchr("bdoj", option) == nullptr) {
+			workerOptions.insert(workerOptions.end(), argv + optionStart, argv + optind);
+		}
+		optionStart = optind;
+	}
+
+	int    nArgs = argc - optind;
+	char **args  = argv + optind;
+
+	if (batchList != nullptr || batchDir != nullptr) {
+		if (nArgs < 3) {
+			usage(std::cerr, "Not enough command line parameters", argv[0]);
+		}
+
+		if (scanList != nullptr) {
+			usage(std::cerr, "--scan can't be used with --batch or --batch-dir", argv[0]);
+		}
+
+		std::vector<std::pair<std::string, std::string>> conversions;
+		if (batchList != nullptr && !readBatchList(batchList, conversions)) {
+			usage(std::cerr, "Failed to read the batch list", argv[0]);
+		}
+
+		if (batchDir != nullptr) {
+			if (outputTemplate == nullptr) {
+				usage(std::cerr, "--batch-dir needs --output-template", argv[0]);
+			}
+
+			if (!listBatchDirectory(batchDir, outputTemplate, conversions)) {
+				usage(std::cerr, "Failed to list the batch directory", argv[0]);
+			}
+		}
+
+		std::vector<std::string> settings(args, args + nArgs);
+
+		std::cout << "== Converting " << conversions.size() << " files with " << numJobs << " workers" << std::endl;
+		std::cout << std::endl;
+
+		int numFailed = runBatch(argv[0], conversions, workerOptions, settings, numJobs);
+
+		std::exit(numFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
 	// Make sure we have enough command line parameters.
 
-	if (argc < 6) {
+	if ((scanList == nullptr && nArgs < 5) || nArgs < 1) {
 		usage(std::cerr, "Not enough command line parameters", argv[0]);
 	}
 
+	// One engine per trigger setting. Without --scan there is only one.
+
+	std::vector<MDPPSCPSROSoftTrigger *> cores;
+	std::vector<std::string> outURIs;
+	int optionalArg;
+	if (scanList != nullptr) {
+		if (!readScanList(scanList, cores, outURIs) || cores.empty()) {
+			usage(std::cerr, "No trigger setting in the scan list", argv[0]);
+		}
+
+		optionalArg = 1;
+	} else {
+		MDPPSCPSROSoftTrigger *core = new MDPPSCPSROSoftTrigger();
+		core -> setWindow(atoi(args[2]), atof(args[3]), atof(args[4]));
+
+		cores.push_back(core);
+		outURIs.push_back(args[1]);
+
+		optionalArg = 5;
+	}
+
 	// Create the data source.   Data sources allow us to specify ring item
 	// types that will be skipped.  They also allow us to specify types
 	// that we may only want to sample (e.g. for online ring items).
@@ -679,130 +1355,280 @@ int main(int argc, char **argv)
 	std::vector<std::uint16_t> exclude;    // Insert the skippable types here.
 	CDataSource* pDataSource;
 	try {
-		pDataSource = CDataSourceFactory::makeSource(argv[1], sample, exclude);
-		std::cout << "==  Connecting to the input RingBuffer: " << argv[1] << std::endl;
+		pDataSource = CDataSourceFactory::makeSource(args[0], sample, exclude);
+		std::cout << "==  Connecting to the input RingBuffer: " << args[0] << std::endl;
 	}
 	catch (CException &e) {
 		std::cerr << "Failed to open ring source\b" << std::endl;
 		usage(std::cerr, e.ReasonText(), argv[0]);
 	}
 
-	// Create a data sink that can be passed to the data processor.
-	// this is wrappedn in an std::unique_ptr to ensure if an exception
-	// stops the program it the sink is properly destructed (flushing and closing it).
+	// With more sources, all are merged in time order before the trigger.
+	// Each hit is decoded by the merger with the rollover counter of its own source.
+
+	std::unique_ptr<MDPPSCPSROMerger> pMerger;
+	if (!mergeURIs.empty()) {
+		MDPPSCPSROSoftTrigger *decoder = cores[0];
+		pMerger.reset(new MDPPSCPSROMerger([decoder](CRingItem &item, MDPPSCPSRO &hit) { decoder -> unpack(item, hit); },
+		                                   std::chrono::milliseconds(maxLag_ms)));
+		pMerger -> addSource(pDataSource, clockOffsets_ns[0]*1000/MDPP_TDC_UNIT);
+
+		for (size_t i = 0; i < mergeURIs.size(); i++) {
+			try {
+				CDataSource *pMergeSource = CDataSourceFactory::makeSource(mergeURIs[i], sample, exclude);
+				pMerger -> addSource(pMergeSource, clockOffsets_ns[i + 1]*1000/MDPP_TDC_UNIT);
+				std::cout << "==  Connecting to the input RingBuffer: " << mergeURIs[i] << " (source " << i + 1 << ", clock offset " << clockOffsets_ns[i + 1] << " ns)" << std::endl;
+			}
+			catch (CException &e) {
+				std::cerr << "Failed to open ring source\b" << std::endl;
+				usage(std::cerr, e.ReasonText(), argv[0]);
+			}
+		}
+	}
+
+	// Create a data sink per engine that can be passed to the data processor.
+	// These are wrapped in std::unique_ptr to ensure if an exception
+	// stops the program the sinks are properly destructed (flushing and closing them).
+	// Scan settings without an output only feed the summary and get a sink discarding everything.
 	//
 
-	CDataSink* pSink;
-	try {
-		CDataSinkFactory factory;
-		pSink = factory.makeSink(argv[2]);
-		std::cout << "== Connecting to the output RingBuffer: " << argv[2] << std::endl;
-	}
-	catch (CException& e) {
-		std::cerr << "Failed to create data sink: ";
-		usage(std::cerr, e.ReasonText(), argv[0]);
+	std::vector<std::unique_ptr<CDataSink>> sinks;
+	for (auto &outURI : outURIs) {
+		CDataSink* pSink;
+		if (outURI.empty()) {
+			pSink = new CNullDataSink();
+		} else {
+			try {
+				CDataSinkFactory factory;
+				pSink = factory.makeSink(outURI);
+				std::cout << "== Connecting to the output RingBuffer: " << outURI << std::endl;
+			}
+			catch (CException& e) {
+				std::cerr << "Failed to create data sink: ";
+				usage(std::cerr, e.ReasonText(), argv[0]);
+			}
+
+			if (indexInterval_ms > 0 && outURI.compare(0, 7, "file://") == 0) {
+				std::string indexPath = outURI.substr(7) + ".idx";
+				CIndexedDataSink *pIndexedSink = new CIndexedDataSink(pSink, indexPath, indexInterval_ms*1.0E9/MDPP_TDC_UNIT);
+				if (pIndexedSink -> isOpen()) {
+					std::cout << "==         Writing the time index: " << indexPath << std::endl;
+				} else {
+					std::cerr << "Failed to create the time index: " << indexPath << std::endl;
+				}
+
+				pSink = pIndexedSink;
+			} else if (indexInterval_ms > 0) {
+				std::cerr << "== No time index for a non-file output: " << outURI << std::endl;
+			}
+		}
+		sinks.emplace_back(pSink);
 	}
-	std::unique_ptr<CDataSink> sink(pSink);
 
-	core -> triggerChannel = atoi(argv[3]);
-	core -> windowStart_ns = atof(argv[4]);
-	core -> windowWidth_ns = atof(argv[5]);
-	core -> windowStart    = core -> windowStart_ns*1000/MDPP_TDC_UNIT;
-	core -> windowWidth    = core -> windowWidth_ns*1000/MDPP_TDC_UNIT;
+	bool cut3s = 0;
+	if (nArgs > optionalArg) {
+		cut3s = atoi(args[optionalArg]);
+	}
 
-	if (argc > 6) {
-		core -> cut3s = atoi(argv[6]);
-	} else {
-		core -> cut3s = 0;
+	int rfChannel = -1;
+	if (nArgs > optionalArg + 1) {
+		rfChannel = atoi(args[optionalArg + 1]);
 	}
 
-	if (argc > 7) {
-		core -> rfChannel = atoi(argv[7]);
-	} else {
-		core -> rfChannel = -1;
+	for (auto core : cores) {
+		core -> cut3s     = cut3s;
+		core -> rfChannel = rfChannel;
+
+		core -> sourceId    = sourceId;
+		core -> barrierType = barrierType;
+
+		core -> isMerged = !mergeURIs.empty();
+
+		if (calibrate) {
+			core -> pCalibrator.reset(new MDPPSCPSROCalibrator(core -> triggerChannel, NUM_CHANNEL,
+			                                                   calibrationRange_ns*1000/MDPP_TDC_UNIT, calibrationBin_ns*1000/MDPP_TDC_UNIT));
+			core -> calibrationTriggers    = calibrationTriggers;
+			core -> nextCalibrationAttempt = calibrationTriggers;
+		}
 	}
 
 	std::cout << std::endl;
-	std::cout << "==  Software trigger channel: " << core -> triggerChannel << std::endl;
-	std::cout << "== Trigger window start (ns): " << core -> windowStart_ns << std::endl;
-	std::cout << "== Trigger window width (ns): " << core -> windowWidth_ns << std::endl;
+	if (scanList != nullptr) {
+		std::cout << "== Scanning " << cores.size() << " trigger settings from " << scanList << std::endl;
+	} else {
+		std::cout << "==  Software trigger channel: " << cores[0] -> triggerChannel << std::endl;
+		std::cout << "== Trigger window start (ns): " << cores[0] -> windowStart_ns << std::endl;
+		std::cout << "== Trigger window width (ns): " << cores[0] -> windowWidth_ns << std::endl;
+	}
 
 	bool isIgnore3s = 0;
-	if (core -> cut3s == 1) {
+	if (cut3s == 1) {
 		std::cout << "== Ignoring the intial 3sec data!" << std :: endl;
 
 		isIgnore3s = 1;
 	}
 
 	bool isFirstRFDetected = 1;
-	if (core -> rfChannel != -1) {
-		std::cout << "== RF channel " << core -> rfChannel << " is specified." << std :: endl;
+	if (rfChannel != -1) {
+		std::cout << "== RF channel " << rfChannel << " is specified." << std :: endl;
 		std::cout << "   Only data within the complete RF cycle will be sent." << std :: endl;
 
 		isFirstRFDetected = 0;
 	}
+
+	if (idleTimeout_ms > 0) {
+		std::cout << "== Flushing after " << idleTimeout_ms << " ms without hits, " << idleMargin_ms << " ms behind the wall clock." << std :: endl;
+	}
+
+	if (scalerWatermark) {
+		std::cout << "== Flushing up to " << idleMargin_ms << " ms before the scaler end time." << std :: endl;
+	}
 	std::cout << std::endl;
 
 	// The loop below consumes items from the ring buffer until
 	// all are used up.  The use of an std::unique_ptr ensures that the
 	// dynamically created ring items we get from the data source are
 	// automatically deleted when we exit the block in which it's created.
+	// Hits are decoded once and every engine keeps its own copy.
+
+	// With the idle timeout, the source is read on its own thread so that the wait for
+	// the next item can time out and the watermark can move on with the wall clock.
+
+	std::unique_ptr<CThreadedDataSource> pReader;
+	if (idleTimeout_ms > 0 && !pMerger) {
+		pReader.reset(new CThreadedDataSource(pDataSource));
+	}
+
+	std::chrono::milliseconds idleTimeout(idleTimeout_ms);
+	std::chrono::milliseconds  idleMargin(idleMargin_ms);
+	std::chrono::milliseconds waitTime(idleTimeout_ms > 0 ? idleTimeout_ms : 100);
+	std::chrono::steady_clock::time_point lastHitTime = std::chrono::steady_clock::now();
+	uint64_t lastHitTimestamp = 0;
 
 	std::cout << "== Starting processing software trigger" << std::endl;
 
 	CRingItem *pItem;
-	while ((pItem = pDataSource -> getItem() )) {
-		CRingItem &item = *pItem;
+	MDPPSCPSRO anEvent;
+	while (true) {
+		bool isReady = true;
+		bool isHit   = false;
+		if (pMerger) {
+			MDPPSCPSROMerger::Next next = pMerger -> getNext(anEvent, pItem, waitTime);
+			if (next == MDPPSCPSROMerger::END) {
+				break;
+			}
+
+			isReady = next != MDPPSCPSROMerger::NOTHING;
+			isHit   = next == MDPPSCPSROMerger::HIT;
+		} else if (pReader) {
+			isReady = pReader -> getItem(pItem, waitTime);
+		} else {
+			pItem = pDataSource -> getItem();
+		}
 
-		if (item.type() == PHYSICS_EVENT) {
-			MDPPSCPSRO &anEvent = core -> unpack(item);
+		if (idleTimeout_ms > 0) {
+			std::chrono::steady_clock::duration idleTime = std::chrono::steady_clock::now() - lastHitTime;
+			// Hits up to the margin ago may still sit in the controller buffer.
+			if (lastHitTimestamp != 0 && idleTime >= idleTimeout && idleTime > idleMargin) {
+				double idleTime_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(idleTime - idleMargin).count();
+				uint64_t watermark = lastHitTimestamp + static_cast<uint64_t>(idleTime_ns*1000/MDPP_TDC_UNIT);
 
+				for (size_t i = 0; i < cores.size(); i++) {
+					cores[i] -> advanceWatermark(*sinks[i], watermark);
+				}
+			}
+		}
+
+		if (!isReady) {
+			continue;
+		}
+
+		if (!isHit) {
+			if (pItem == nullptr) {
+				break;
+			}
+
+			if (pItem -> type() == PHYSICS_EVENT) {
+				cores[0] -> unpack(*pItem, anEvent);
+				isHit = true;
+			}
+		}
+
+		if (isHit) {
 			if (isIgnore3s) {
-				isIgnore3s = core -> getMdppTimestamp_ns(anEvent) < 3.0E9;
+				isIgnore3s = cores[0] -> getMdppTimestamp_ns(anEvent) < 3.0E9;
 
 				if (isIgnore3s) {
-				  std::unique_ptr<MDPPSCPSRO> pAnEvent(&anEvent);
 					continue;
 				}
 			}
 
 			if (!isFirstRFDetected) {
-				isFirstRFDetected = anEvent.ch == core -> rfChannel;
+				isFirstRFDetected = anEvent.ch == rfChannel;
 
 				if (!isFirstRFDetected) {
-					std::unique_ptr<MDPPSCPSRO> pAnEvent(&anEvent);
 					continue;
 				}
 			}
 
-			if (core -> flushRFQueueRequested && !core -> dataCollecting) {
-				core -> flushRFQueue(*sink);
-				core -> flushRFQueueRequested = false;
+			for (size_t i = 0; i < cores.size(); i++) {
+				cores[i] -> processEvent(*sinks[i], anEvent);
 			}
 
-			if (core -> rfChannel != -1 && anEvent.ch == core -> rfChannel) {
-				if (core -> dataCollecting) {
-					core -> flushRFQueueRequested = true;
-				} else {
-					core -> flushRFQueue(*sink);
-					core -> flushRFQueueRequested = false;
+			lastHitTime      = std::chrono::steady_clock::now();
+			lastHitTimestamp = cores[0] -> latestAbsoluteMdppTimestamp;
+
+			continue;
+		}
+
+		CRingItem &item = *pItem;
+
+		if (item.type() == END_RUN || item.type() == ABNORMAL_ENDRUN) {
+			std::unique_ptr<CRingItem> upItem(pItem);
+
+			for (size_t i = 0; i < cores.size(); i++) {
+				cores[i] -> emptyingQueues(*sinks[i]);
+
+				if (cores[i] -> pCalibrator) {
+					cores[i] -> printCalibration(std::cout);
 				}
+				sinks[i] -> putItem(item);
 			}
-
-			core -> hitDeque.push_back(&anEvent);
-			core -> updateTimestamps(anEvent);
-			core -> sending(*sink, anEvent.ch == core -> triggerChannel);
-		} else if (item.type() == END_RUN || item.type() == ABNORMAL_ENDRUN) {
-			core -> emptyingQueues(*sink);
-			core -> send(*sink, item);
 		} else if (item.type() == PHYSICS_EVENT_COUNT) {
 			std::unique_ptr<CRingItem> upItem(pItem);
+		} else if (item.type() == PERIODIC_SCALERS && scalerWatermark) {
+			std::unique_ptr<CRingItem> upItem(pItem);
+
+			// The end time is a float, so it's taken one step down to never be ahead of the data.
+			CRingScalerItem scaler(item);
+			double endTime_s   = std::nextafter(scaler.computeEndTime(), 0.f);
+			double watermark_s = endTime_s - idleMargin_ms/1000.;
+
+			for (size_t i = 0; i < cores.size(); i++) {
+				if (watermark_s > 0) {
+					cores[i] -> advanceWatermark(*sinks[i], static_cast<uint64_t>(std::floor(watermark_s*1.0E12/MDPP_TDC_UNIT)));
+				}
+				sinks[i] -> putItem(item);
+			}
 		} else {
-			core -> send(*sink, item);
+			std::unique_ptr<CRingItem> upItem(pItem);
+
+			for (auto &sink : sinks) {
+				sink -> putItem(item);
+			}
 		}
 	}
 
 	std::cout << "== Ending processing software trigger" << std::endl;
+
+	if (scanList != nullptr) {
+		std::cout << std::endl;
+		std::cout << "== Scan summary" << std::endl;
+		for (size_t i = 0; i < cores.size(); i++) {
+			std::cout << "   #" << i << " ";
+			cores[i] -> printSummary(std::cout);
+		}
+	}
 	
 	// We can only fall through here for file data sources... normal exit
 	std::exit(EXIT_SUCCESS);
@@ -13,6 +13,8 @@ namespace eval MDPPSCPSROSoftTrigger {
   variable pipe {}
   variable oldring {}
   variable parser [::Actions %AUTO%]
+  variable idleTimeout 1000;# ms without hits before pending trigger windows are flushed
+  variable idleMargin  1000;# ms of readout latency, the VMUSB buffer timeout
   set ::DefaultActions::name "MDPP-16/32 SCP SRO Software Trigger"
 
   proc register {} {
@@ -62,6 +64,8 @@ namespace eval MDPPSCPSROSoftTrigger {
 		variable pipe
 		variable parser
 		variable oldring
+		variable idleTimeout
+		variable idleMargin
 
 		# on the first time running, kill of old processes, and launch a new one.
 		if {$pipe eq {}} {
@@ -71,7 +75,7 @@ namespace eval MDPPSCPSROSoftTrigger {
 			killOldProvider $outring
 
 			set cmd [file join $cmdpath MDPPSCPSROSoftTrigger]
-			set pipe [open "| $cmd  tcp://localhost/$inring tcp://localhost/$outring $trigCh $windowStart $windowWidth |& cat" r]
+			set pipe [open "| $cmd --idle-timeout=$idleTimeout --idle-margin=$idleMargin tcp://localhost/$inring tcp://localhost/$outring $trigCh $windowStart $windowWidth |& cat" r]
 
 			chan configure $pipe -blocking 0
 			chan configure $pipe -buffering line